@@ -66,7 +66,7 @@ template <typename T>
 class Atomic {
     volatile T value;
 public:
-    Atomic(T x) : value(x) {}
+    constexpr Atomic(T x) : value(x) {}
     Atomic<T>& operator= (T v) {
         __atomic_store_n(&value,v,__ATOMIC_SEQ_CST);
         return *this;
@@ -202,7 +202,7 @@ class InterruptSafeLock  {
     volatile bool was;
 public:    
     Atomic<uint32_t> ref_count;
-    InterruptSafeLock() : taken(false), was(false), ref_count(0) {}
+    constexpr InterruptSafeLock() : taken(false), was(false), ref_count(0) {}
 
     InterruptSafeLock(const InterruptSafeLock&) = delete;
 
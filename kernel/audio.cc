@@ -10,29 +10,105 @@
 #include "physmem.h"
 #include "config.h"
 #include "vmm.h"
+#include "threads.h"
+#include "machine.h"
+#include "idt.h"
+#include "smp.h"
+#include "pit.h"
+#include "mixer.h"
+#include "irq.h"
+#include "timer.h"
 
 
 // update interrupt status
 using namespace audio;
 
-// Handles any interrupts - not technically needed to implement audio but since we have interrupts enabled we must have this
+hda_audio_device* audio::primary = nullptr;
+
+// Entries in the DMA position buffer are 8 bytes, one per stream descriptor in
+// descriptor order
+static uint32_t output_dma_pos(hda_audio_device* device) {
+    return device->dma_pos[2 * device->output->sd->index] % (BDL_SIZE * BUFFER_SIZE);
+}
+
+// Bytes the hardware has played since the stream started. The position only
+// goes around the cyclic buffer so it has to be read at least once per trip,
+// every IOC does that.
+static uint64_t advance_clock(hda_audio_device* device) {
+    uint32_t pos = output_dma_pos(device);
+    if (pos < device->last_dma_pos) {
+        device->played_base += BDL_SIZE * BUFFER_SIZE;
+    }
+    device->last_dma_pos = pos;
+    return device->played_base + pos;
+}
+
+static uint64_t played_bytes(hda_audio_device* device) {
+    LockGuardP g{device->clock_lock};
+    return advance_clock(device);
+}
+
+// The hardware just finished playing "buffer", wake up the refill thread so it can
+// put the next chunk there while the other buffers play
+void audio::audio_buffer_complete(audio_stream* stream, uint32_t buffer) {
+    hda_audio_device* hda = stream->device->driver;
+    // a late IOC from a stream we already stopped
+    if (!hda->running) return;
+    hda->ioc_tsc[buffer] = rdtsc();
+    // a wrap of the position is never more than one buffer away from here
+    played_bytes(hda);
+    hda->stats.iocs++;
+    hda->xruns.periods++;
+    hda->periods_played++;
+    hda->mmap_info->periods = hda->periods_played;
+    // the refill thread notices if the hardware got ahead of it, a whole
+    // period is too much to clear in here
+    hda->refill->up();
+}
+
+static void rirb_drain(hda_audio_device* device);
+
+// Handles any interrupts from the controller. Runs with interrupts disabled so
+// it only timestamps the buffer and hands the real work to the refill thread
 void handle_interrupt(hda_audio_device* device) {
     // Grab current values
     uint32_t curr_int_sts = REG_INL(device, REG_INTSTS);
-    uint8_t curr_out_sts = REG_INB(device, REG_O0_STS);
 
-    Debug::printf("Handling interrupt: intsts: %x, outsts: %x, num bufs completed: %d\n", curr_int_sts, curr_out_sts, device->num_buffs_completed);
+    // one status bit per stream descriptor
+    uint32_t count = device->iss + device->oss + device->bss;
+    for (uint32_t i = 0; i < count; i++) {
+        if ((curr_int_sts & (1 << i)) == 0) continue;
+        hda_stream_desc* sd = &device->sds[i];
+        uint8_t sts = REG_INB(device, sd->base + SD_STS);
+
+        if (sts & SDSTS_BCIS) {
+            if (sd == device->output->sd) {
+                // the engine's buffer finished
+                audio_buffer_complete(device->output->stream, device->num_buffs_completed);
+                device->num_buffs_completed++;
+                device->num_buffs_completed %= BDL_SIZE;
+            } else if (device->input != nullptr && sd == device->input->sd && device->input->running) {
+                // a captured period is ready
+                device->input->completed++;
+                device->input->period->up();
+            }
+        }
+        REG_OUTB(device, sd->base + SD_STS, sts);
+    }
 
-    // Interrupt for stream 1 = buffer finished
-    if (curr_out_sts & 0x4) {
-        //audio_buffer_complete(device->output->stream, device->num_buffs_completed); Method not defined anywhere??
-        device->num_buffs_completed++;
-        device->num_buffs_completed %= BDL_SIZE;
+    // Codec responses
+    if (REG_INB(device, REG_RIRBSTS) & RIRBSTS_RINTFL) {
+        LockGuardP g{device->verb_lock};
+        rirb_drain(device);
     }
 
     // Reset values
     REG_OUTL(device, REG_INTSTS, curr_int_sts);
-    REG_OUTB(device, REG_O0_STS, curr_out_sts);
+}
+
+// called by IRQ's dispatcher with interrupts disabled
+static void hda_interrupt(void* arg) {
+    handle_interrupt((hda_audio_device*) arg);
 }
 
 // Initialize the CORB data structure
@@ -93,85 +169,191 @@ static void init_rirb(hda_audio_device* device) {
     REG_OUTL(device, REG_RIRBLBASE, rirb_base_addr & 0xFFFFFFFF);
     REG_OUTL(device, REG_RIRBUBASE, (uint32_t)((uint64_t)rirb_base_addr >> 32));
 
-    // set interrupt cnt register
+    // interrupt after this many responses, or earlier when the codecs have
+    // answered everything in the CORB
     REG_OUTB(device, REG_RINTCNT, 0x42);
+    device->rirb_rp = 0;
 
     // start DMA
-    REG_OUTB(device, REG_RIRBCTL, 0x02);
+    REG_OUTB(device, REG_RIRBCTL, RIRBCTL_RIRBRUN | RIRBCTL_RINTCTL);
 }
 
-// Write the given verb to the CORB at the next available spot
-static void corb_write(hda_audio_device* device, uint32_t verb) {
+// Move verbs of the pending batches into the CORB while it has room, the
+// controller sees all of them with one CORBWP write. We never have more verbs
+// outstanding than the CORB holds so the RIRB can't overflow either.
+// Caller holds verb_lock.
+static void corb_pump(hda_audio_device* device) {
     uint16_t write_pointer = REG_INW(device, REG_CORBWP) & 0xFF;
-    uint16_t read_pointer, next;
+    uint32_t written = 0;
+
+    for (auto batch = device->verbs_head; batch != nullptr; batch = batch->next) {
+        while (batch->sent < batch->count && device->verbs_in_flight < device->corb_entries - 1) {
+            write_pointer = (write_pointer + 1) % device->corb_entries;
+            device->corb[write_pointer] = batch->verbs[batch->sent++];
+            device->verbs_in_flight++;
+            written++;
+        }
+        // keep the order, the responses are matched by it
+        if (batch->sent < batch->count) break;
+    }
 
-    // next available spot in corb - take modulus for the ring 
-    next = (write_pointer + 1) % device->corb_entries;
+    if (written != 0) {
+        REG_OUTW(device, REG_CORBWP, write_pointer);
+        device->verbs_sent += written;
+    }
+}
 
-    // wait until there's space in corb to write 
-    do {
-        read_pointer = REG_INW(device, REG_CORBRP) & 0xFF;
-    } while (next == read_pointer);
+// Hand every response in the RIRB to the batch that asked for it and refill
+// the CORB. Called by the interrupt handler, or by waiters when interrupts
+// aren't routed. Caller holds verb_lock.
+static void rirb_drain(hda_audio_device* device) {
+    uint16_t write_pointer = REG_INW(device, REG_RIRBWP) & 0xFF;
+    REG_OUTB(device, REG_RIRBSTS, RIRBSTS_RINTFL | RIRBSTS_RIRBOIS);
 
-    // found space, write to corb
-    device->corb[next] = verb;
-    REG_OUTW(device, REG_CORBWP, next);
-}
+    while (device->rirb_rp != write_pointer) {
+        device->rirb_rp = (device->rirb_rp + 1) % device->rirb_entries;
+        uint64_t entry = device->rirb[device->rirb_rp];
 
-// Waits for an available RIRB entry to read from.
-// When an entry is found, increments rirb's read pointer,
-// and reads entry into *read.
-static void rirb_read(hda_audio_device* device, uint64_t* read){
-    uint16_t write_pointer;
-    // last accessed read_pointer read from RIRB
-    uint16_t read_pointer = device->rirb_rp;
+        if ((entry >> 32) & RIRB_EX_UNSOL) {
+            device->unsolicited++;
+            continue;
+        }
+        auto batch = device->verbs_head;
+        if (batch == nullptr) continue;
+
+        batch->responses[batch->received++] = (uint32_t) entry;
+        device->verbs_in_flight--;
+        if (batch->received == batch->count) {
+            device->verbs_head = batch->next;
+            if (device->verbs_head == nullptr) device->verbs_tail = nullptr;
+            batch->complete = true;
+            batch->done.up();
+        }
+    }
 
-    // do while searches for an entry in RIRB
-    do {
-        write_pointer = REG_INW(device, REG_RIRBWP) & 0xFF;
-    } while (write_pointer == read_pointer);
+    corb_pump(device);
+}
 
-    // go to next unread read pointer in RIRB to read
-    read_pointer = (read_pointer + 1) % device->rirb_entries;
-    device->rirb_rp = read_pointer;
+void audio::codec_submit(hda_audio_device* device, hda_verb_batch* batch) {
+    if (batch->count == 0) {
+        batch->complete = true;
+        batch->done.up();
+        return;
+    }
+    LockGuardP g{device->verb_lock};
+    batch->next = nullptr;
+    if (device->verbs_tail == nullptr) {
+        device->verbs_head = batch;
+    } else {
+        device->verbs_tail->next = batch;
+    }
+    device->verbs_tail = batch;
+    device->batches_sent++;
+    corb_pump(device);
+}
 
-    // read from RIRB into uint64_t ptr
-    *read = device->rirb[read_pointer];
-    REG_OUTB(device, REG_RIRBSTS, 0x5);
+void audio::codec_wait(hda_audio_device* device, hda_verb_batch* batch) {
+    if (device->rirb_irq) {
+        batch->done.down();
+        return;
+    }
+    while (!batch->complete) {
+        {
+            LockGuardP g{device->verb_lock};
+            rirb_drain(device);
+        }
+        if (!batch->complete) iAmStuckInALoop(false);
+    }
 }
 
-// Facilitates communication between corb and rirb. codec, widget, and payload
-// parameters define the communication. Using these instructions, write to corb, then
-// read from rirb and return the response.
+static void codec_run(hda_audio_device* device, hda_verb_batch* batch) {
+    codec_submit(device, batch);
+    codec_wait(device, batch);
+}
+
+// Sends one verb and waits for its response. Fine for the odd control change,
+// anything that walks the codec should batch.
 static uint32_t codec_transmission(hda_audio_device* device, int codec, int widget_id, uint32_t payload){
-    uint64_t read;
-    // Generate corb input with codec, widget id, and payload
-    uint32_t verb = ((codec & 0xf) << 28) |
-                    ((widget_id & 0xff) << 20) |
-                    (payload & 0xfffff);
+    hda_verb_batch batch(1);
+    batch.add(codec, widget_id, payload);
+    codec_run(device, &batch);
+    return batch.responses[0];
+}
 
-    // write to corb with generated input
-    corb_write(device, verb);
-    // read from rirb; should be able receive communication from corb
-    rirb_read(device, &read);
 
-    return read & 0xffffffff;
+// Every rate a converter can advertise in PARAM_PCM_SIZE_RATE (bit i is entry i)
+// and how the stream format spells it
+static const struct {
+    uint32_t rate;
+    uint16_t format;
+} rate_formats[] = {
+    {   8000, SR_48_KHZ | (5 << SR_DIV_SHIFT) },
+    {  11025, SR_44_KHZ | (3 << SR_DIV_SHIFT) },
+    {  16000, SR_48_KHZ | (2 << SR_DIV_SHIFT) },
+    {  22050, SR_44_KHZ | (1 << SR_DIV_SHIFT) },
+    {  32000, SR_48_KHZ | (1 << SR_MULT_SHIFT) | (2 << SR_DIV_SHIFT) },
+    {  44100, SR_44_KHZ },
+    {  48000, SR_48_KHZ },
+    {  88200, SR_44_KHZ | (1 << SR_MULT_SHIFT) },
+    {  96000, SR_48_KHZ | (1 << SR_MULT_SHIFT) },
+    { 176400, SR_44_KHZ | (3 << SR_MULT_SHIFT) },
+    { 192000, SR_48_KHZ | (3 << SR_MULT_SHIFT) },
+};
+
+static int caps_rate_index(uint32_t pcm_caps, uint32_t rate) {
+    for (uint32_t i = 0; i < sizeof(rate_formats) / sizeof(rate_formats[0]); i++) {
+        if (rate_formats[i].rate == rate && (pcm_caps & (1 << i))) {
+            return i;
+        }
+    }
+    return -1;
 }
 
+static int rate_index(hda_audio_device* device, uint32_t rate) {
+    return caps_rate_index(device->output->pcm_caps, rate);
+}
 
-static void output_widget_config(hda_audio_device* device){
-    uint16_t format = BITS_16 | device->output->sample_rate |
-                      (device->output->num_channels - 1);
+static uint32_t format_cap(audio_sample_format format) {
+    switch (format) {
+        case AUDIO_8SI: return PCM_BITS_8;
+        case AUDIO_16SI: return PCM_BITS_16;
+        case AUDIO_20SI: return PCM_BITS_20;
+        case AUDIO_24SI: return PCM_BITS_24;
+        default: return PCM_BITS_32;
+    }
+}
+
+static uint16_t format_bits(audio_sample_format format) {
+    switch (format) {
+        case AUDIO_8SI: return BITS_8;
+        case AUDIO_16SI: return BITS_16;
+        case AUDIO_20SI: return BITS_20;
+        case AUDIO_24SI: return BITS_24;
+        default: return BITS_32;
+    }
+}
 
-    codec_transmission(device, device->output->codec, device->output->node_id,
+// Program the converter and the stream descriptor with the same format
+static void output_widget_config(hda_audio_device* device){
+    hda_audio_output* output = device->output;
+    int i = rate_index(device, output->sample_rate);
+    // audio_set_sample_rate only picks supported rates, 48kHz is just a safe default
+    uint16_t format = rate_formats[i < 0 ? 6 : i].format | format_bits(output->sample_format) |
+                      (output->num_channels - 1);
+    output->format = format;
+
+    codec_transmission(device, output->codec, output->node_id,
         VERB_SET_FORMAT | format);
 
-    REG_OUTL(device, REG_O0_FMT, format);
+    REG_OUTW(device, output->sd->base + SD_FMT, format);
 
 }
 
 void init_output_widget(hda_audio_device* device){
-    device->output = new hda_audio_output();
+    device->output->sd = stream_alloc(device, true);
+    if (device->output->sd == nullptr) {
+        Debug::panic("*** audio: no output stream descriptor\n");
+    }
     device->output->stream = new audio_stream();
     device->output->stream->device = device->audio;
     device->output->stream->num_buffers = BDL_SIZE;
@@ -179,65 +361,98 @@ void init_output_widget(hda_audio_device* device){
     device->output->stream->sample_format = AUDIO_16SI;
 
     
-    codec_transmission(device, device->output->codec, device->output->node_id, VERB_SET_STREAM_CHANNEL | 0x10);
+    codec_transmission(device, device->output->codec, device->output->node_id, VERB_SET_STREAM_CHANNEL | (device->output->sd->tag << 4));
 
-    device->output->sample_rate = SR_48_KHZ;
+    // nothing useful in the caps (older codecs), assume the 44.1/48kHz 16 bit every codec does
+    if ((device->output->pcm_caps & 0xfff) == 0 || (device->output->pcm_caps & PCM_BITS_16) == 0) {
+        device->output->pcm_caps = PCM_BITS_16 | (1 << 5) | (1 << 6);
+    }
+    Debug::printf("| audio: converter %d takes rates/sizes %x, up to %d channels\n",
+        device->output->node_id, device->output->pcm_caps, device->output->max_channels);
+
+    device->output->sample_rate = 48000;
+    device->output->sample_format = AUDIO_16SI;
     device->output->num_channels = 2;
     output_widget_config(device);
 }
 
-// Debug tool to see what widgets are connected to the audio device.
-static void debug_widget_connections(hda_audio_device* device, int codec, int node_id) {
-    uint32_t num_connections = codec_transmission(device, codec, node_id, VERB_GET_PARAMETER | PARAM_CONN_LIST_LEN);
-    if (num_connections == 0) {
-        return;
+// What we ask every widget when probing, a function group's widgets all go out in one batch
+enum WIDGET_QUERY {
+    Q_WIDGET_CAP, Q_OUT_AMP_CAP, Q_IN_AMP_CAP, Q_EAPD, Q_GAIN_LEFT, Q_GAIN_RIGHT,
+    Q_PIN_CAP, Q_PIN_CONTROL, Q_CONFIG_DEFAULT, Q_CONN_LEN, Q_PCM, Q_COUNT
+};
+
+static const uint32_t widget_queries[Q_COUNT] = {
+    VERB_GET_PARAMETER | PARAM_AUDIO_WID_CAP,
+    VERB_GET_PARAMETER | PARAM_OUT_AMP_CAP,
+    VERB_GET_PARAMETER | PARAM_IN_AMP_CAP,
+    VERB_GET_EAPD_BTL,
+    VERB_GET_AMP_GAIN_MUTE | 0x8000,
+    VERB_GET_AMP_GAIN_MUTE | 0xA000,
+    VERB_GET_PARAMETER | PARAM_PIN_CAP,
+    VERB_GET_PIN_CONTROL,
+    VERB_GET_CONFIG_DEFAULT,
+    VERB_GET_PARAMETER | PARAM_CONN_LIST_LEN,
+    VERB_GET_PARAMETER | PARAM_PCM_SIZE_RATE,
+};
+
+// Queue the verbs that read a widget's connection list and its selection.
+// Short form entries are 8 bits (4 per response), long form 16 bits (2 per response).
+static void queue_connections(hda_verb_batch* batch, int codec, int node_id, uint32_t conn_len) {
+    uint32_t per_response = (conn_len & 0x80) ? 2 : 4;
+    for (uint32_t i = 0; i < (conn_len & 0x7F); i += per_response) {
+        batch->add(codec, node_id, VERB_GET_CONN_LIST | i);
     }
-    uint32_t selected_connection;
-    for (uint32_t i = 0; i < (num_connections & 0x7F); i++) {
-        uint32_t current_connection;
-        int index, shift;
-        if (num_connections & 0x80) {
-            index = i & ~3;
-            shift = 8 * (i & 3);
-        } else {
-            index = i & ~1;
-            shift = 8 * (i & 1);
+    batch->add(codec, node_id, VERB_GET_CONN_SELECT);
+}
+
+// Fills in the widget's connections from what the verbs of queue_connections got
+// back. A range entry stands for every node from the previous entry up to it.
+// Returns how many responses it used.
+static uint32_t parse_connections(hda_widget* widget, uint32_t conn_len, const uint32_t* responses) {
+    bool long_form = conn_len & 0x80;
+    uint32_t per_response = long_form ? 2 : 4;
+    uint32_t entries = conn_len & 0x7F;
+    uint32_t used = (entries + per_response - 1) / per_response;
+
+    // twice over the list: count, then fill in
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t n = 0;
+        uint32_t previous = 0;
+        for (uint32_t i = 0; i < entries; i++) {
+            uint32_t current_connection = responses[i / per_response];
+            bool range;
+            if (long_form) {
+                current_connection >>= 16 * (i & 1);
+                range = current_connection & 0x8000;
+                current_connection &= 0x7FFF;
+            } else {
+                current_connection >>= 8 * (i & 3);
+                range = current_connection & 0x80;
+                current_connection &= 0x7F;
+            }
+
+            uint32_t from = (range && i > 0 && previous < current_connection) ? previous + 1 : current_connection;
+            for (uint32_t node = from; node <= current_connection; node++) {
+                if (pass == 1) widget->conns[n] = node;
+                n++;
+            }
+            previous = current_connection;
         }
-        current_connection = codec_transmission(device, codec, node_id, VERB_GET_CONN_LIST | index);
-        current_connection >>= shift;
-
-        bool range;
-        if (num_connections & 0x80) {
-            range = current_connection & 0x8000;
-            current_connection &= 0x7FFF;
-        } else {
-            range = current_connection & 0x80;
-            current_connection &= 0x7F;
+        if (pass == 0) {
+            widget->num_conns = n;
+            widget->conns = new uint16_t[n == 0 ? 1 : n];
         }
-
-        Debug::printf("Widget Connection: %c%d\n", range ? '-' : ' ', current_connection);
     }
 
-    selected_connection = codec_transmission(device, codec, node_id, VERB_GET_CONN_SELECT);
-    Debug::printf("Currently selected widget: %d\n", selected_connection);
+    widget->selected = responses[used] & 0xFF;
+    return used + 1;
 }
 
-// start setting up afg codec and widgets
-static void init_widget(hda_audio_device* device, int codec, int node_id) {
-    uint32_t widget_capability, amp_capability, eapd_capability;
-    WIDGET_TYPE type;
-
-    widget_capability = codec_transmission(device, codec, node_id, VERB_GET_PARAMETER | PARAM_AUDIO_WID_CAP);
-    // not ready to initialize
-    if (widget_capability == 0) {
-        return;
-    }
-    type = (WIDGET_TYPE)((widget_capability & WIDGET_CAP_TYPE_MASK) >> WIDGET_CAP_TYPE_SHIFT);
-    amp_capability = codec_transmission(device, codec, node_id, VERB_GET_PARAMETER | PARAM_OUT_AMP_CAP);
-    eapd_capability = codec_transmission(device, codec, node_id, VERB_GET_EAPD_BTL);
-
+// Debug tool to see what a widget is and what is connected to it.
+static void debug_widget(hda_widget* widget) {
     const char* widget_name;
-    switch (type) {
+    switch (widget->type) {
         case 0: widget_name = "WIDGET: Output"; break;
         case 1: widget_name = "WIDGET: Input"; break;
         case 2: widget_name = "WIDGET: Mixer"; break;
@@ -250,82 +465,357 @@ static void init_widget(hda_audio_device* device, int codec, int node_id) {
         default: widget_name = "WIDGET: Unknown"; break;
     }
 
-    uint32_t gain = codec_transmission(device, codec, node_id, VERB_GET_AMP_GAIN_MUTE | 0x8000) << 8;
-    gain |= codec_transmission(device, codec, node_id, VERB_GET_AMP_GAIN_MUTE | 0xA000);
+    Debug::printf("INIT WIDGET  Widget type: %s; Node_ID: %d; WidgetCap: %x, EAPDCap: %x, Amp: %x/%x, Config: %x\n", 
+                widget_name, widget->node_id, widget->caps, widget->eapd, widget->gain, widget->out_amp_caps,
+                widget->config_default);
+    for (uint32_t i = 0; i < widget->num_conns; i++) {
+        Debug::printf("Widget Connection: %d\n", widget->conns[i]);
+    }
+    if (widget->num_conns != 0) {
+        Debug::printf("Currently selected widget: %d\n", widget->selected);
+    }
+}
 
-    // debug statements; can comment out these two lines
-    Debug::printf("INIT WIDGET  Widget type: %s; Node_ID: %d; WidgetCap: %x, EAPDCap: %x, Amp: %x/%x\n", 
-                widget_name, node_id, widget_capability, eapd_capability, gain, amp_capability);
-    debug_widget_connections(device, codec, node_id);
+// Builds the widget graph of the codec's audio function group. Three batches:
+// the function groups, everything about every widget, the connection lists.
+// Returns nullptr if the codec has no audio function group.
+static hda_codec* codec_probe(hda_audio_device* device, int address) {
+    uint32_t parameter = codec_transmission(device, address, 0, VERB_GET_PARAMETER | PARAM_NODE_COUNT);
+    int num_func_groups = parameter & 0xFF;
+    int func_group_start = (parameter >> 16) & 0xFF;
 
-    // actually setting widget registers
-    switch (type) {
-        case WIDGET_OUTPUT:
-        {
-            if (!device->output->node_id) {
-                device->output->codec = codec;
-                device->output->node_id = node_id;
-                device->output->amp_gain = (amp_capability >> 8) & 0x7F;
+    hda_verb_batch groups(num_func_groups * 5);
+    for (int i = 0; i < num_func_groups; i++) {
+        groups.add(address, func_group_start + i, VERB_GET_PARAMETER | PARAM_NODE_COUNT);
+        groups.add(address, func_group_start + i, VERB_GET_PARAMETER | PARAM_FN_GROUP_TYPE);
+        groups.add(address, func_group_start + i, VERB_GET_PARAMETER | PARAM_PCM_SIZE_RATE);
+        groups.add(address, func_group_start + i, VERB_GET_PARAMETER | PARAM_OUT_AMP_CAP);
+        groups.add(address, func_group_start + i, VERB_GET_PARAMETER | PARAM_IN_AMP_CAP);
+    }
+    codec_run(device, &groups);
+
+    for (int i = 0; i < num_func_groups; i++) {
+        const uint32_t* group = &groups.responses[i * 5];
+        if ((group[1] & 0x7F) != GROUP_AUDIO) {
+            continue;
+        }
+
+        hda_codec* codec = new hda_codec();
+        codec->address = address;
+        codec->afg = func_group_start + i;
+        codec->num_widgets = group[0] & 0xFF;
+        codec->first_node = (group[0] >> 16) & 0xFF;
+        codec->widgets = new hda_widget[codec->num_widgets]();
+
+        hda_verb_batch query(codec->num_widgets * Q_COUNT + 1);
+        query.add(address, codec->afg, VERB_SET_POWER_STATE | 0x0);
+        for (uint32_t j = 0; j < codec->num_widgets; j++) {
+            for (uint32_t q = 0; q < Q_COUNT; q++) {
+                query.add(address, codec->first_node + j, widget_queries[q]);
             }
-            codec_transmission(device, codec, node_id, VERB_SET_EAPD_BTL | eapd_capability | 0x2);
-            break;
         }
-        case WIDGET_PIN:
-        {
-            uint32_t pin_capability, control;
-            pin_capability = codec_transmission(device, codec, node_id, VERB_GET_PARAMETER | PARAM_PIN_CAP);
-            if ((pin_capability & PIN_CAP_OUTPUT) == 0) {
-                return;
+        codec_run(device, &query);
+
+        uint32_t conn_verbs = 0;
+        for (uint32_t j = 0; j < codec->num_widgets; j++) {
+            const uint32_t* info = &query.responses[1 + j * Q_COUNT];
+            hda_widget* widget = &codec->widgets[j];
+            widget->node_id = codec->first_node + j;
+            widget->caps = info[Q_WIDGET_CAP];
+            widget->type = (widget->caps & WIDGET_CAP_TYPE_MASK) >> WIDGET_CAP_TYPE_SHIFT;
+            bool own_amps = widget->caps & WIDGET_CAP_AMP_OVR;
+            widget->out_amp_caps = own_amps ? info[Q_OUT_AMP_CAP] : group[3];
+            widget->in_amp_caps = own_amps ? info[Q_IN_AMP_CAP] : group[4];
+            widget->eapd = info[Q_EAPD];
+            widget->gain = (info[Q_GAIN_LEFT] << 8) | info[Q_GAIN_RIGHT];
+            widget->pin_caps = info[Q_PIN_CAP];
+            widget->pin_control = info[Q_PIN_CONTROL];
+            widget->config_default = info[Q_CONFIG_DEFAULT];
+            widget->pcm_caps = (widget->caps & WIDGET_CAP_FORMAT_OVR) ? info[Q_PCM] : group[2];
+            conn_verbs += (info[Q_CONN_LEN] & 0x7F) / 2 + 2;
+        }
+
+        hda_verb_batch conns(conn_verbs);
+        for (uint32_t j = 0; j < codec->num_widgets; j++) {
+            queue_connections(&conns, address, codec->first_node + j, query.responses[1 + j * Q_COUNT + Q_CONN_LEN]);
+        }
+        codec_run(device, &conns);
+
+        const uint32_t* conn = conns.responses;
+        for (uint32_t j = 0; j < codec->num_widgets; j++) {
+            conn += parse_connections(&codec->widgets[j], query.responses[1 + j * Q_COUNT + Q_CONN_LEN], conn);
+        }
+        return codec;
+    }
+    return nullptr;
+}
+
+// How much we want to play through a pin, lower is better. -1 if we can't.
+static int pin_rank(hda_widget* widget) {
+    if (widget->type != WIDGET_PIN || (widget->pin_caps & PIN_CAP_OUTPUT) == 0) {
+        return -1;
+    }
+    if ((widget->config_default >> CONFIG_PORT_SHIFT) == CONFIG_PORT_NONE) {
+        return -1;
+    }
+    switch ((widget->config_default >> CONFIG_DEVICE_SHIFT) & CONFIG_DEVICE_MASK) {
+        case CONFIG_DEVICE_LINE_OUT: return 0;
+        case CONFIG_DEVICE_SPEAKER: return 1;
+        case CONFIG_DEVICE_HP_OUT: return 2;
+        default: return 3;
+    }
+}
+
+// How much we want to record from a pin, lower is better. -1 if we can't.
+static int input_pin_rank(hda_widget* widget) {
+    if (widget->type != WIDGET_PIN || (widget->pin_caps & PIN_CAP_INPUT) == 0) {
+        return -1;
+    }
+    if ((widget->config_default >> CONFIG_PORT_SHIFT) == CONFIG_PORT_NONE) {
+        return -1;
+    }
+    switch ((widget->config_default >> CONFIG_DEVICE_SHIFT) & CONFIG_DEVICE_MASK) {
+        case CONFIG_DEVICE_LINE_IN: return 0;
+        case CONFIG_DEVICE_MIC_IN: return 1;
+        default: return 2;
+    }
+}
+
+static bool is_dac(hda_widget* widget, int) {
+    return widget->type == WIDGET_OUTPUT;
+}
+
+static bool is_input_pin(hda_widget* widget, int rank) {
+    return input_pin_rank(widget) == rank;
+}
+
+// Depth first from "widget" through mixers and selectors until is_end says we
+// are there. The path so far is in path->widgets[0 .. depth).
+static bool find_route(hda_codec* codec, hda_path* path, hda_widget* widget, uint32_t depth,
+        bool (*is_end)(hda_widget*, int), int rank) {
+    for (uint32_t i = 0; i < depth; i++) {
+        if (path->widgets[i] == widget) return false;
+    }
+    path->widgets[depth] = widget;
+    path->length = depth + 1;
+
+    if (depth > 0 && is_end(widget, rank)) return true;
+    if (depth + 1 == MAX_PATH_LEN) return false;
+    if (depth > 0 && widget->type != WIDGET_MIXER && widget->type != WIDGET_SELECTOR) return false;
+
+    for (uint32_t i = 0; i < widget->num_conns; i++) {
+        hda_widget* next = codec_widget(codec, widget->conns[i]);
+        if (next == nullptr) continue;
+        path->conn[depth] = i;
+        if (find_route(codec, path, next, depth + 1, is_end, rank)) return true;
+    }
+    return false;
+}
+
+// The best pin that leads to a converter, by pin_rank and then graph order
+static bool find_output_path(hda_audio_device* device, hda_path* path) {
+    for (int rank = 0; rank <= 3; rank++) {
+        for (int c = 0; c < 15; c++) {
+            hda_codec* codec = device->codecs[c];
+            if (codec == nullptr) continue;
+            for (uint32_t j = 0; j < codec->num_widgets; j++) {
+                hda_widget* pin = &codec->widgets[j];
+                if (pin_rank(pin) != rank) continue;
+                path->codec = codec;
+                if (find_route(codec, path, pin, 0, is_dac, 0)) return true;
             }
-            control = codec_transmission(device, codec, node_id, VERB_GET_PIN_CONTROL) | PIN_CTL_ENABLE_OUTPUT;
-            codec_transmission(device, codec, node_id, VERB_SET_PIN_CONTROL | control);
-            codec_transmission(device, codec, node_id, VERB_SET_EAPD_BTL | eapd_capability | 0x2);
-            break;
         }
-        default: return;
     }
+    return false;
+}
 
-    // enable power control
-    if (widget_capability & WIDGET_CAP_POWER_CNTRL) {
-        codec_transmission(device, codec, node_id, VERB_SET_POWER_STATE | 0x0);
+// An ADC and the best input pin it can reach, by input_pin_rank and then graph order
+static bool find_input_path(hda_audio_device* device, hda_path* path) {
+    for (int rank = 0; rank <= 2; rank++) {
+        for (int c = 0; c < 15; c++) {
+            hda_codec* codec = device->codecs[c];
+            if (codec == nullptr) continue;
+            for (uint32_t j = 0; j < codec->num_widgets; j++) {
+                hda_widget* adc = &codec->widgets[j];
+                if (adc->type != WIDGET_INPUT || adc->caps == 0) continue;
+                path->codec = codec;
+                if (find_route(codec, path, adc, 0, is_input_pin, rank)) return true;
+            }
+        }
     }
+    return false;
 }
 
-// Enumerates and initializes widgets for the codec. Returns 0 on successly initializing at least one widget, -1 on failure.
-static int codec_init_widgets(hda_audio_device* device, int codec) {
-    uint32_t parameter = codec_transmission(device, codec, 0, VERB_GET_PARAMETER | PARAM_NODE_COUNT);
-    int num_func_groups, num_widgets;
-    num_func_groups = parameter & 0xFF;
-    int func_group_start, widget_start;
-    func_group_start = (parameter >> 16) & 0xFF;
+// The 0dB step of an amp, unmuted
+static uint32_t amp_unity(uint32_t amp_caps) {
+    return amp_caps & AMP_CAP_OFFSET_MASK;
+}
 
-    for (int i = 0; i < num_func_groups; i++) {
-        parameter = codec_transmission(device, codec, func_group_start + i, VERB_GET_PARAMETER | PARAM_NODE_COUNT);
-        num_widgets = parameter & 0xFF;
-        widget_start = (parameter >> 16) & 0xFF;
-        parameter = codec_transmission(device, codec, func_group_start + i, VERB_GET_PARAMETER | PARAM_FN_GROUP_TYPE) & 0x7F;
-        if (parameter != GROUP_AUDIO) {
-            continue;
+// Powers up and routes only the widgets on the path, one batch. The amp
+// audio_set_volume moves is left alone, every other amp goes to 0dB. A capture
+// path starts at the ADC and its pin is switched to input.
+static void program_path(hda_audio_device* device, hda_path* path, bool capture) {
+    // at most 5 verbs per widget, the worst is a pin: power, connection
+    // select, output amp, pin control and EAPD (or its input amp). An ADC
+    // takes 4, a mixer 3. Anything added below has to fit in here.
+    hda_verb_batch setup(path->length * 5);
+    int address = path->codec->address;
+
+    for (uint32_t i = 0; i < path->length; i++) {
+        hda_widget* widget = path->widgets[i];
+        int node_id = widget->node_id;
+
+        if (widget->caps & WIDGET_CAP_POWER_CNTRL) {
+            setup.add(address, node_id, VERB_SET_POWER_STATE | 0x0);
         }
-        codec_transmission(device, codec, func_group_start + i, VERB_SET_POWER_STATE | 0x0);
-        for (int j = 0; j < num_widgets; j++) {
-            init_widget(device, codec, widget_start + j);
+
+        // pick the input the path comes through
+        if (i + 1 < path->length) {
+            uint32_t conn = path->conn[i];
+            bool mixer = widget->type == WIDGET_MIXER;
+            if (!mixer && widget->num_conns > 1) {
+                setup.add(address, node_id, VERB_SET_CONN_SELECT | conn);
+                widget->selected = conn;
+            }
+            // mixers and ADCs have an amp on every input
+            if ((mixer || widget->type == WIDGET_INPUT) && (widget->caps & WIDGET_CAP_IN_AMP)) {
+                setup.add(address, node_id, VERB_SET_AMP_GAIN_MUTE | AMP_SET_INPUT | AMP_SET_LEFT | AMP_SET_RIGHT |
+                    (conn << AMP_SET_INDEX_SHIFT) | amp_unity(widget->in_amp_caps));
+            }
+        }
+
+        if ((widget->caps & WIDGET_CAP_OUT_AMP) && widget != device->output->volume) {
+            uint32_t gain = amp_unity(widget->out_amp_caps);
+            setup.add(address, node_id, VERB_SET_AMP_GAIN_MUTE | AMP_SET_OUTPUT | AMP_SET_LEFT | AMP_SET_RIGHT | gain);
+            widget->gain = (gain << 8) | gain;
+        }
+
+        if (widget->type == WIDGET_PIN && capture) {
+            widget->pin_control = PIN_CTL_ENABLE_INPUT;
+            setup.add(address, node_id, VERB_SET_PIN_CONTROL | PIN_CTL_ENABLE_INPUT);
+            if (widget->caps & WIDGET_CAP_IN_AMP) {
+                setup.add(address, node_id, VERB_SET_AMP_GAIN_MUTE | AMP_SET_INPUT | AMP_SET_LEFT | AMP_SET_RIGHT |
+                    amp_unity(widget->in_amp_caps));
+            }
+        } else if (widget->type == WIDGET_PIN) {
+            uint32_t control = PIN_CTL_ENABLE_OUTPUT;
+            if (((widget->config_default >> CONFIG_DEVICE_SHIFT) & CONFIG_DEVICE_MASK) == CONFIG_DEVICE_HP_OUT &&
+                (widget->pin_caps & PIN_CAP_HP_DRIVE)) {
+                control |= PIN_CTL_ENABLE_HP;
+            }
+            widget->pin_control = control;
+            setup.add(address, node_id, VERB_SET_PIN_CONTROL | control);
+            if (widget->pin_caps & PIN_CAP_EAPD) {
+                setup.add(address, node_id, VERB_SET_EAPD_BTL | widget->eapd | 0x2);
+            }
+        }
+    }
+    codec_run(device, &setup);
+}
+
+// Use the converter at the end of the path for output
+static void use_output(hda_audio_device* device, hda_codec* codec, hda_widget* dac) {
+    hda_audio_output* output = device->output;
+    output->codec = codec->address;
+    output->node_id = dac->node_id;
+    output->dac = dac;
+    output->max_channels = (((dac->caps & WIDGET_CAP_CHAN_EXT_MASK) >> (WIDGET_CAP_CHAN_EXT_SHIFT - 1)) |
+        (dac->caps & WIDGET_CAP_STEREO)) + 1;
+    output->pcm_caps = dac->pcm_caps;
+
+    // volume goes on the first amp after the converter
+    output->volume = nullptr;
+    for (int i = output->path.length - 1; i >= 0; i--) {
+        if (output->path.widgets[i]->caps & WIDGET_CAP_OUT_AMP) {
+            output->volume = output->path.widgets[i];
+            break;
         }
     }
-    return device->output->node_id ? 0 : -1;
+    output->amp_gain = output->volume ? (output->volume->out_amp_caps >> 8) & 0x7F : 0;
 }
 
-// Picks the first available output widget to use as our output codec. If we structure this better, we can have multiple outputs,
-// but since we didn't structure this to use an audio device on a bus provided by the PCI, we can't. We are now simply using the PCI slot for one device.
+static void route_output(hda_audio_device* device);
+static void route_input(hda_audio_device* device);
+
+// Probes every codec that answered, then routes the best output pin and the
+// best input pin. Only the widgets on those paths are touched.
 static void audio_init_codec(hda_audio_device* device) {
     uint16_t state_status = REG_INW(device, REG_STATESTS);
     for (int i = 0; i < 15; i++) {
         if (state_status & (1 << i)) {
-            if (codec_init_widgets(device, i)) {
-                return;
+            device->codecs[i] = codec_probe(device, i);
+            if (device->codecs[i] == nullptr) continue;
+            // debug statements; can comment out this loop
+            for (uint32_t j = 0; j < device->codecs[i]->num_widgets; j++) {
+                if (device->codecs[i]->widgets[j].caps != 0) debug_widget(&device->codecs[i]->widgets[j]);
             }
         }
     }
+
+    route_output(device);
+    route_input(device);
+}
+
+// Routes the best input pin to an ADC. No input, no recording.
+static void route_input(hda_audio_device* device) {
+    hda_path path;
+    if (!find_input_path(device, &path)) {
+        Debug::printf("| audio: nothing to record from\n");
+        return;
+    }
+
+    hda_audio_input* input = new hda_audio_input();
+    input->path = path;
+    input->adc = path.widgets[0];
+    input->codec = path.codec->address;
+    input->node_id = input->adc->node_id;
+    program_path(device, &input->path, true);
+    device->input = input;
+    device->audio->recorder = 1;
+
+    hda_widget* pin = path.widgets[path.length - 1];
+    Debug::printf("| audio: input from pin %d (device %d), %d widgets, converter %d\n",
+        pin->node_id, (pin->config_default >> CONFIG_DEVICE_SHIFT) & CONFIG_DEVICE_MASK,
+        path.length, input->node_id);
+}
+
+// Routes the best output pin to its converter. If no pin leads to one we fall
+// back to the first converter with every output pin enabled.
+static void route_output(hda_audio_device* device) {
+    hda_path* path = &device->output->path;
+    if (find_output_path(device, path)) {
+        use_output(device, path->codec, path->widgets[path->length - 1]);
+        program_path(device, path, false);
+        Debug::printf("| audio: output through pin %d (device %d), %d widgets, converter %d\n",
+            path->widgets[0]->node_id, (path->widgets[0]->config_default >> CONFIG_DEVICE_SHIFT) & CONFIG_DEVICE_MASK,
+            path->length, device->output->node_id);
+        return;
+    }
+
+    for (int i = 0; i < 15; i++) {
+        hda_codec* codec = device->codecs[i];
+        if (codec == nullptr) continue;
+        for (uint32_t j = 0; j < codec->num_widgets; j++) {
+            if (codec->widgets[j].type != WIDGET_OUTPUT || codec->widgets[j].caps == 0) continue;
+            path->codec = codec;
+            path->length = 1;
+            path->widgets[0] = &codec->widgets[j];
+            use_output(device, codec, &codec->widgets[j]);
+            program_path(device, path, false);
+
+            hda_verb_batch pins(codec->num_widgets);
+            for (uint32_t k = 0; k < codec->num_widgets; k++) {
+                hda_widget* pin = &codec->widgets[k];
+                if (pin->type == WIDGET_PIN && (pin->pin_caps & PIN_CAP_OUTPUT)) {
+                    pin->pin_control |= PIN_CTL_ENABLE_OUTPUT;
+                    pins.add(codec->address, pin->node_id, VERB_SET_PIN_CONTROL | pin->pin_control);
+                }
+            }
+            codec_run(device, &pins);
+            Debug::printf("| audio: no output path, using converter %d on every pin\n", device->output->node_id);
+            return;
+        }
+    }
 }
 
 void audio_reset(hda_audio_device* device) {
@@ -334,59 +824,128 @@ void audio_reset(hda_audio_device* device) {
     REG_OUTL(device, REG_RIRBCTL, 0);
     // wait for the corb and rirb buffers to stop running
     while (REG_INL(device, REG_CORBCTL) & CORBCTL_CORBRUN || REG_INL(device, REG_RIRBCTL) & RIRBCTL_RIRBRUN);
-    // may need some delay here
     // reset hardware
     REG_OUTL(device, REG_GCTL, 0);
     while (REG_INL(device, REG_GCTL) & GCTL_RESET);
     REG_OUTL(device, REG_GCTL, GCTL_RESET);
     while ((REG_INL(device, REG_GCTL) & GCTL_RESET) == 0);
+    // codecs get 521us after reset to ask for an address, two jiffies
+    // covers that however far into the current one we are
+    sleep_jiffies(2);
     // clear interrupts
     REG_OUTW(device, REG_WAKEEN, 0xFFFF);
-    REG_OUTL(device, REG_INTCTL, 0x800000FF);
+    // stream interrupts are enabled as the descriptors get handed out
+    REG_OUTL(device, REG_INTCTL, INTCTL_GIE | INTCTL_CIE);
 
     // restart audio - set up buffers again
     init_corb(device);
     init_rirb(device);
 
-    // may need some delay here? might have to use jiffies in pit.h
+    uint64_t start = rdtsc();
     audio_init_codec(device);
+    Debug::printf("| audio: codec bring-up took %dus, %d verbs in %d batches\n",
+        Pit::tscToMicros(rdtsc() - start), device->verbs_sent, device->batches_sent);
+}
+
+// Counts the stream descriptors. A GCAP without output streams isn't a real
+// controller, those get the ICH6 layout the driver always assumed (4 in, 4 out).
+static void stream_pool_init(hda_audio_device* device) {
+    uint16_t gcap = REG_INW(device, REG_GCAP);
+    device->iss = (gcap >> GCAP_ISS_SHIFT) & 0xf;
+    device->oss = (gcap >> GCAP_OSS_SHIFT) & 0xf;
+    device->bss = (gcap >> GCAP_BSS_SHIFT) & 0x1f;
+    if (device->oss + device->bss == 0) {
+        device->iss = 4;
+        device->oss = 4;
+    }
+
+    uint32_t count = device->iss + device->oss + device->bss;
+    device->sds = new hda_stream_desc[count]();
+    for (uint32_t i = 0; i < count; i++) {
+        hda_stream_desc* sd = &device->sds[i];
+        sd->index = i;
+        sd->base = REG_SD_BASE + i * SD_STRIDE;
+        sd->output = i >= device->iss;
+        sd->bidir = i >= device->iss + device->oss;
+    }
+    device->sd_lock = new InterruptSafeLock();
+    Debug::printf("| audio: %d input, %d output, %d bidirectional streams\n",
+        device->iss, device->oss, device->bss);
+}
+
+hda_stream_desc* audio::stream_alloc(hda_audio_device* device, bool output) {
+    uint32_t count = device->iss + device->oss + device->bss;
+    hda_stream_desc* sd = nullptr;
+    {
+        LockGuardP g{device->sd_lock};
+        // tags only have to be unique among streams going the same way
+        uint32_t tags = 1;
+        for (uint32_t i = 0; i < count; i++) {
+            hda_stream_desc* other = &device->sds[i];
+            if (other->in_use && other->output == output) tags |= 1 << other->tag;
+            if (sd == nullptr && !other->in_use && (other->bidir || other->output == output)) {
+                // a bidirectional one only if nothing else is left, they come last
+                sd = other;
+            }
+        }
+        if (sd == nullptr || tags == 0xffff) return nullptr;
+        uint8_t tag = 1;
+        while (tags & (1 << tag)) tag++;
+        sd->tag = tag;
+        sd->output = output;
+        sd->in_use = true;
+    }
+    REG_OUTL(device, REG_INTCTL, REG_INL(device, REG_INTCTL) | (1 << sd->index));
+    return sd;
+}
+
+void audio::stream_free(hda_audio_device* device, hda_stream_desc* sd) {
+    REG_OUTB(device, sd->base + SD_CTLL, 0);
+    REG_OUTL(device, REG_INTCTL, REG_INL(device, REG_INTCTL) & ~(1 << sd->index));
+    LockGuardP g{device->sd_lock};
+    sd->in_use = false;
+    sd->tag = 0;
 }
 
 void stream_descriptor_init(hda_audio_device* device) {
     uint32_t bld_b, dma_pos;
     int i;
+    hda_stream_desc* sd = device->output->sd;
 
     //set reg for ouput 
-    REG_OUTB(device, REG_O0_CTLU, 0x10);
-    REG_OUTL(device, REG_O0_CBL, BDL_SIZE * BUFFER_SIZE);
-    REG_OUTW(device, REG_O0_STLVI, BDL_SIZE -1);
+    REG_OUTB(device, sd->base + SD_CTLU, (sd->tag << 4) | (sd->bidir ? SD_CTLU_DIR : 0));
+    REG_OUTL(device, sd->base + SD_CBL, BDL_SIZE * BUFFER_SIZE);
+    REG_OUTW(device, sd->base + SD_STLVI, BDL_SIZE -1);
     
     // Set buffer list 
     bld_b = (uintptr_t) device->rings->pa[0] + 3072;
-    REG_OUTL(device, REG_O0_BDLPL, bld_b & 0xFFFFFFFF);
-    REG_OUTL(device, REG_O0_BDLPU, (uint32_t)((uint64_t)bld_b >> 32));
+    REG_OUTL(device, sd->base + SD_BDLPL, bld_b & 0xFFFFFFFF);
+    REG_OUTL(device, sd->base + SD_BDLPU, (uint32_t)((uint64_t)bld_b >> 32));
     for(i = 0; i < BDL_SIZE; i++) {
-        device->bdl[i]->addr = device->completed_buffers->pa[0] + (i * BUFFER_SIZE);
-        device->bdl[i]->length = BUFFER_SIZE;
-        device->bdl[i]->flags = 1;
+        device->bdl[i].addr = device->completed_buffers->pa[0] + (i * BUFFER_SIZE);
+        device->bdl[i].addr_hi = 0;
+        device->bdl[i].length = BUFFER_SIZE;
+        device->bdl[i].flags = 1; // interrupt on completion of every buffer
     }
 
-    //memset(device->completed_buffers->va, 0, BDL_SIZE * BUFFER_SIZE); from "string.h" but causes problems so commented out temporarily
-
     // init DMA pos in buffer
-    for(i = 0; i < 8; i++) {
+    for(i = 0; i < (int) (2 * (device->iss + device->oss + device->bss)); i++) {
         device->dma_pos[i] = 0;
     }
 
-    dma_pos = (uintptr_t) device->rings->pa[0] + 3072 + ROUNDED_BDL_BYTES;
+    dma_pos = (uintptr_t) device->dma_pos;
     REG_OUTL(device, REG_DPLBASE, (dma_pos & 0xffffffff) | 0x1); // marked as TODO needs another look
     REG_OUTL(device, REG_DPUBASE, (uint32_t)((uint64_t)dma_pos >> 32));
 }
 
+// Moves the first amp after the converter. Its step count comes from the graph
+// so this is a single verb, and none at all when the gain doesn't change.
 void audio_set_volume(audio_stream* stream, uint8_t volume) {
-    hda_audio_device* hda = (hda_audio_device*) stream->device;
+    hda_audio_device* hda = stream->device->driver;
+    hda_widget* amp = hda->output->volume;
+    if (amp == nullptr) return;
+
     int meta = 0xB000; // output amp
-    hda->output = new hda_audio_output();
     if(volume == 0) {
         //set mute bit
         volume = 0x80;
@@ -394,30 +953,30 @@ void audio_set_volume(audio_stream* stream, uint8_t volume) {
         // scale volume to amp_gain
         volume = volume * hda->output->amp_gain / 255;
     }
-    codec_transmission(hda, hda->output->codec, hda->output->node_id, VERB_SET_AMP_GAIN_MUTE | meta | volume);  
+    uint32_t gain = (volume << 8) | volume;
+    if (gain == amp->gain) return;
+    amp->gain = gain;
+    codec_transmission(hda, hda->output->codec, amp->node_id, VERB_SET_AMP_GAIN_MUTE | meta | volume);  
 }
 
+// Runs the converter at "sr" if it can, otherwise at 48kHz (44.1kHz if that's all
+// it has) and the caller has to convert. Returns the rate in use.
 int audio_set_sample_rate(audio_stream* stream, int sr) {
 
-    hda_audio_device* hda = (hda_audio_device*) stream->device;
+    hda_audio_device* hda = stream->device->driver;
 
-    switch(sr) {
-        case 44100:
-            hda->output->sample_rate = SR_44_KHZ;
-            break;
-        default:
-            sr = 48000;
-            hda->output->sample_rate = SR_48_KHZ;
-            break;
+    if (rate_index(hda, sr) < 0) {
+        sr = (rate_index(hda, 48000) >= 0) ? 48000 : 44100;
     }
+    hda->output->sample_rate = sr;
     output_widget_config(hda);
     return sr;  
 }
 
 int audio_set_chnl_ct(audio_device* dev, int channels) {
-    hda_audio_device* hda = (hda_audio_device*) dev->device;
-    if(channels < 1 || channels > 2) {
-        channels = 2;
+    hda_audio_device* hda = dev->driver;
+    if(channels < 1 || channels > hda->output->max_channels) {
+        channels = hda->output->max_channels;
     }
 
     hda->output->num_channels = channels;
@@ -426,60 +985,502 @@ int audio_set_chnl_ct(audio_device* dev, int channels) {
     return channels;
 }
 
+// Picks the sample size. Data in 32 bit containers plays as 24 or 20 bit on
+// converters without 32 bit support, the low bits are just ignored. Returns
+// the format in use or -1 if there is none with that container size.
+int audio_set_sample_format(audio_device* dev, audio_sample_format format) {
+    hda_audio_device* hda = dev->driver;
+    uint32_t caps = hda->output->pcm_caps;
+
+    if ((caps & format_cap(format)) == 0) {
+        if (audio_sample_bytes(format) != 4) return -1;
+        if (caps & PCM_BITS_32) format = AUDIO_32SI;
+        else if (caps & PCM_BITS_24) format = AUDIO_24SI;
+        else if (caps & PCM_BITS_20) format = AUDIO_20SI;
+        else return -1;
+    }
+
+    hda->output->sample_format = format;
+    output_widget_config(hda);
+    return format;
+}
+
 void get_audio_pos(audio_stream* stream, audio_position* pos) {
     
-    hda_audio_device* hda = (hda_audio_device*)stream->device;
-    uint32_t position = hda->dma_pos[4] & 0xffffffff;
+    hda_audio_device* hda = stream->device->driver;
+    uint32_t position = output_dma_pos(hda);
 
     pos->buffer = position / BUFFER_SIZE;
     pos->frame = (position % BUFFER_SIZE) / 2;
 
 }
 
-PCI::pci_device* init_dev(PCI::pci_device* device) {
-    hda_audio_device* hda;
+// How long the hardware takes to play one BDL buffer
+static uint32_t buffer_period_us(hda_audio_device* device) {
+    hda_audio_output* output = device->output;
+    uint32_t bytes_per_second = output->sample_rate * output->num_channels *
+                                audio_sample_bytes(output->sample_format);
+    return K::div64((uint64_t)BUFFER_SIZE * 1000000, bytes_per_second);
+}
 
-    hda = (hda_audio_device*)malloc(sizeof(hda_audio_device));
-    hda->rings = new mem_area();
-    hda->rings->pa = (uint32_t*)(PhysMem::alloc_frame() | 7);
-    hda->rings->va = (void*) 0xFEC01000;
-    gheith::map(gheith::current()->pd, (uint32_t)hda->rings->va, (uint32_t)hda->rings->pa);
-    hda->corb = (uint32_t*) ((uintptr_t) hda->rings->va + 0);
-    hda->rirb = (uint32_t*) ((uintptr_t) hda->rings->va + 1024);
-    hda->bdl = (audio_bdl_entry**) ((uintptr_t) hda->rings->va + 3072);
-    hda->dma_pos = (uint32_t*) ((uintptr_t) hda->rings->va + 3072 + ROUNDED_BDL_BYTES);
+static void stream_reset(hda_audio_device* device, hda_stream_desc* sd) {
+    uint32_t ctl = sd->base + SD_CTLL;
+    REG_OUTB(device, ctl, SDCTL_SRST);
+    while ((REG_INB(device, ctl) & SDCTL_SRST) == 0);
+    REG_OUTB(device, ctl, 0);
+    while (REG_INB(device, ctl) & SDCTL_SRST);
+}
 
-    if(hda->rings == nullptr) {
-        PhysMem::dealloc_frame((uint32_t)hda->rings->pa);
-        free(hda);
+static void start_stream(hda_audio_device* device) {
+    // a reset puts the DMA engine back at the start of the BDL but also
+    // clears the descriptor so it has to be programmed again
+    hda_stream_desc* sd = device->output->sd;
+    stream_reset(device, sd);
+    stream_descriptor_init(device);
+    output_widget_config(device);
+    device->num_buffs_completed = 0;
+    device->next_slot = 0;
+    device->played_base = 0;
+    device->last_dma_pos = 0;
+    device->periods_played = 0;
+    device->dma_pos[2 * sd->index] = 0;
+    device->running = true;
+    REG_OUTB(device, sd->base + SD_STS, SDSTS_BCIS | SDSTS_FIFOE | SDSTS_DESE);
+    REG_OUTB(device, sd->base + SD_CTLL, SDCTL_RUN | SDCTL_IOCE);
+}
+
+static void stop_stream(hda_audio_device* device) {
+    REG_OUTB(device, device->output->sd->base + SD_CTLL, 0);
+    device->running = false;
+}
+
+// Put the next chunk from the source in the given slot, pad with silence
+static void refill_slot(hda_audio_device* device, uint32_t slot) {
+    char* buffer = (char*) device->completed_buffers->va + slot * BUFFER_SIZE;
+    uint32_t n = (device->source == nullptr) ? 0 : device->source->fill(buffer, BUFFER_SIZE);
+    if (n < BUFFER_SIZE) {
+        bzero(buffer + n, BUFFER_SIZE - n);
+    }
+    {
+        LockGuardP g{device->clock_lock};
+        device->written += BUFFER_SIZE;
+    }
+    device->periods_filled++;
+    if (n == 0) {
+        device->silent_slots++;
+    } else {
+        device->silent_slots = 0;
+    }
+}
+
+static void report_stats(hda_audio_device* device) {
+    audio_engine_stats& stats = device->stats;
+    Debug::printf("| audio: %d iocs, %d refills, %d late, %d underruns (%d periods silenced since boot), IOC->refill avg %dus max %dus, period %dus\n",
+        stats.iocs, stats.refills, stats.late_refills, stats.underruns, device->xruns.silenced,
+        stats.refills ? Pit::tscToMicros(stats.total_latency) / stats.refills : 0,
+        Pit::tscToMicros(stats.max_latency), buffer_period_us(device));
+}
+
+// The refill thread. Every IOC means the hardware is done with a slot and has moved
+// on to the next one, so we have (BDL_SIZE - 1) periods to refill it. We only ever
+// keep BDL_SIZE * BUFFER_SIZE bytes of the stream resident.
+static void refill_loop(hda_audio_device* device) {
+    while (true) {
+        device->refill->down();
+        LockGuardP g{device->engine_lock};
+        // the process that mapped the buffers fills them
+        if (!device->running || device->mapped_by != nullptr) continue;
+
+        audio_engine_stats& stats = device->stats;
+
+        // The hardware overtook us and is playing what was in the slot
+        // BDL_SIZE periods ago, silence the rest of it. Pick the stream up
+        // again in the period after the one playing now.
+        uint32_t playing = played_bytes(device) / BUFFER_SIZE;
+        if (device->periods_filled <= playing) {
+            bzero((char*) device->completed_buffers->va + (playing % BDL_SIZE) * BUFFER_SIZE, BUFFER_SIZE);
+            stats.underruns++;
+            device->xruns.underruns++;
+            device->xruns.silenced++;
+            {
+                LockGuardP g{device->clock_lock};
+                device->written = (uint64_t) (playing + 1) * BUFFER_SIZE;
+            }
+            device->periods_filled = playing + 1;
+            device->next_slot = (playing + 1) % BDL_SIZE;
+        }
+        // after a skip some of the IOCs find every slot already filled
+        if (device->periods_filled >= device->periods_played + BDL_SIZE) continue;
+
+        uint32_t slot = device->next_slot;
+        device->next_slot = (slot + 1) % BDL_SIZE;
+        refill_slot(device, slot);
+
+        uint64_t latency = rdtsc() - device->ioc_tsc[slot];
+        stats.refills++;
+        stats.total_latency += latency;
+        if (latency > stats.max_latency) stats.max_latency = latency;
+        if (Pit::tscToMicros(latency) > buffer_period_us(device) / 2) stats.late_refills++;
+
+        // every slot has been refilled with silence, the last real sample has played
+        if (device->silent_slots >= BDL_SIZE) {
+            stop_stream(device);
+            report_stats(device);
+        }
+    }
+}
+
+void audio::audio_start(hda_audio_device* device) {
+    LockGuardP g{device->engine_lock};
+    if (device->running) return;
+
+    device->stats = audio_engine_stats();
+    device->silent_slots = 0;
+    device->written = 0;
+    device->periods_filled = 0;
+
+    // prime every slot before the DMA engine starts
+    for (uint32_t slot = 0; slot < BDL_SIZE; slot++) {
+        refill_slot(device, slot);
+    }
+    if (device->silent_slots < BDL_SIZE) {
+        device->silent_slots = 0;
+        start_stream(device);
+    }
+}
+
+void audio::audio_stop(hda_audio_device* device) {
+    LockGuardP g{device->engine_lock};
+    if (device->running) stop_stream(device);
+}
+
+void audio::audio_get_clock(hda_audio_device* device, audio_clock* clock) {
+    hda_audio_output* output = device->output;
+    uint32_t frame_bytes = output->num_channels * audio_sample_bytes(output->sample_format);
+    *clock = audio_clock();
+    clock->rate = output->sample_rate;
+    if (device->running) {
+        uint64_t played, written;
+        {
+            LockGuardP g{device->clock_lock};
+            played = advance_clock(device);
+            written = device->written;
+        }
+        clock->position = K::div64(played, frame_bytes);
+        clock->queued = written > played ? (uint32_t) (written - played) / frame_bytes : 0;
+    }
+    clock->jiffies = Pit::jiffies;
+}
+
+uint32_t audio::audio_mmap(hda_audio_device* device, uint32_t* pd, uint32_t rate, uint32_t channels) {
+    if (!device->mixer->reserve(true)) return 0;
+
+    LockGuardP g{device->engine_lock};
+    if (device->mapped_by != nullptr || audio_set_sample_format(device->audio, AUDIO_16SI) < 0) {
+        if (device->mapped_by == nullptr) device->mixer->reserve(false);
+        return 0;
+    }
+    // the mixer is empty but may still be playing out its last periods
+    if (device->running) stop_stream(device);
+
+    audio_mmap_info* info = device->mmap_info;
+    info->position_index = 2 * device->output->sd->index;
+    info->buffer_bytes = BDL_SIZE * BUFFER_SIZE;
+    info->period_bytes = BUFFER_SIZE;
+    info->channels = audio_set_chnl_ct(device->audio, channels);
+    info->rate = audio_set_sample_rate(device->output->stream, rate);
+    info->periods = 0;
+
+    // start from silence, the process writes ahead of the position from here on
+    bzero(device->completed_buffers->va, BDL_SIZE * BUFFER_SIZE);
+    uint32_t frames = (BDL_SIZE * BUFFER_SIZE) / PhysMem::FRAME_SIZE;
+    for (uint32_t i = 0; i < frames; i++) {
+        gheith::map(pd, AUDIO_MMAP_VA + i * PhysMem::FRAME_SIZE, device->completed_buffers->pa[i]);
+    }
+    gheith::map(pd, AUDIO_MMAP_VA + frames * PhysMem::FRAME_SIZE, (uint32_t) device->dma_pos, 5);
+    device->mapped_by = pd;
+
+    start_stream(device);
+    return AUDIO_MMAP_VA;
+}
+
+void audio::audio_munmap(hda_audio_device* device, uint32_t* pd) {
+    {
+        LockGuardP g{device->engine_lock};
+        if (device->mapped_by != pd) return;
+        if (device->running) stop_stream(device);
+
+        uint32_t frames = (BDL_SIZE * BUFFER_SIZE) / PhysMem::FRAME_SIZE;
+        for (uint32_t i = 0; i <= frames; i++) {
+            gheith::unmap(pd, AUDIO_MMAP_VA + i * PhysMem::FRAME_SIZE, false);
+        }
+        device->mapped_by = nullptr;
+        Debug::printf("| audio: mapped buffers released after %d periods\n", device->mmap_info->periods);
+    }
+    device->mixer->reserve(false);
+}
+
+int audio::audio_play(hda_audio_device* device, audio_source* source, uint32_t rate, uint32_t channels,
+        audio_sample_format format) {
+    int id = device->mixer->open(source, rate, channels, format);
+    if (id < 0) return -1;
+    device->mixer->wait(id);
+    return 0;
+}
+
+// Sets up the capture side once the input is routed: stream tag 2, 16 bit
+// stereo (or mono) at 48kHz when the ADC does it, and the DMA periods
+static void init_input(hda_audio_device* device) {
+    hda_audio_input* input = device->input;
+    if (input == nullptr) return;
+
+    input->sd = stream_alloc(device, false);
+    if (input->sd == nullptr) {
+        Debug::printf("| audio: no input stream descriptor, nothing to record with\n");
+        device->input = nullptr;
+        device->audio->recorder = 0;
+        delete input;
+        return;
+    }
+
+    uint32_t caps = input->adc->pcm_caps;
+    int i = caps_rate_index(caps, 48000);
+    if (i < 0) i = caps_rate_index(caps, 44100);
+    if (i < 0) i = 6;
+    input->sample_rate = rate_formats[i].rate;
+    input->num_channels = (input->adc->caps & WIDGET_CAP_STEREO) ? 2 : 1;
+    input->format = rate_formats[i].format | BITS_16 | (input->num_channels - 1);
+
+    hda_verb_batch setup(2);
+    setup.add(input->codec, input->node_id, VERB_SET_STREAM_CHANNEL | (input->sd->tag << 4));
+    setup.add(input->codec, input->node_id, VERB_SET_FORMAT | input->format);
+    codec_run(device, &setup);
+
+    input->stream = new audio_stream();
+    input->stream->device = device->audio;
+    input->stream->num_buffers = CAPTURE_BDL_SIZE;
+    input->stream->buffer_size = CAPTURE_BUFFER_SIZE / 2;
+    input->stream->sample_format = AUDIO_16SI;
+
+    uint32_t frames = (CAPTURE_BDL_SIZE * CAPTURE_BUFFER_SIZE) / PhysMem::FRAME_SIZE;
+    input->buffers = new mem_area();
+    input->buffers->size = CAPTURE_BDL_SIZE * CAPTURE_BUFFER_SIZE;
+    input->buffers->pa = new uint32_t[frames];
+    input->buffers->pa[0] = PhysMem::alloc_frames(frames);
+    for (uint32_t f = 1; f < frames; f++) {
+        input->buffers->pa[f] = input->buffers->pa[0] + f * PhysMem::FRAME_SIZE;
+    }
+    input->buffers->va = (void*) input->buffers->pa[0];
+
+    // in the rings frame right after the output's BDL, which is rounded up
+    // to the 128 bytes a BDL has to be aligned to
+    input->bdl = (audio_bdl_entry*) ((uintptr_t) device->rings->va + 3072 + ROUNDED_BDL_BYTES);
+    for (uint32_t b = 0; b < CAPTURE_BDL_SIZE; b++) {
+        input->bdl[b].addr = input->buffers->pa[0] + b * CAPTURE_BUFFER_SIZE;
+        input->bdl[b].addr_hi = 0;
+        input->bdl[b].length = CAPTURE_BUFFER_SIZE;
+        input->bdl[b].flags = 1;
+    }
+
+    input->ring = new SpscRing(CAPTURE_RING_SIZE);
+    input->period = new Semaphore(0);
+    input->data = new Semaphore(0);
+    input->reader_waiting = new Atomic<bool>(false);
+    input->read_lock = new BlockingLock();
+
+    Debug::printf("| audio: recording %dHz, %d channels\n", input->sample_rate, input->num_channels);
+}
+
+static void capture_start(hda_audio_device* device) {
+    hda_audio_input* input = device->input;
+    hda_stream_desc* sd = input->sd;
+    stream_reset(device, sd);
+    REG_OUTB(device, sd->base + SD_CTLU, sd->tag << 4);
+    REG_OUTL(device, sd->base + SD_CBL, CAPTURE_BDL_SIZE * CAPTURE_BUFFER_SIZE);
+    REG_OUTW(device, sd->base + SD_STLVI, CAPTURE_BDL_SIZE - 1);
+    REG_OUTL(device, sd->base + SD_BDLPL, (uintptr_t) input->bdl);
+    REG_OUTL(device, sd->base + SD_BDLPU, 0);
+    REG_OUTW(device, sd->base + SD_FMT, input->format);
+
+    input->completed = 0;
+    input->copied = 0;
+    input->overruns = 0;
+    input->running = true;
+    REG_OUTB(device, sd->base + SD_STS, SDSTS_BCIS | SDSTS_FIFOE | SDSTS_DESE);
+    REG_OUTB(device, sd->base + SD_CTLL, SDCTL_RUN | SDCTL_IOCE);
+}
+
+// The capture thread. Moves every period the hardware finished into the ring
+// with one copy and wakes up the reader.
+static void capture_loop(hda_audio_device* device) {
+    hda_audio_input* input = device->input;
+    while (true) {
+        input->period->down();
+        // the interrupt counts periods, extra ups from before a restart find nothing to do
+        while (input->running && input->copied != input->completed) {
+            // the hardware went around the BDL while we weren't looking
+            if (input->completed - input->copied >= CAPTURE_BDL_SIZE) {
+                uint32_t lost = input->completed - input->copied - (CAPTURE_BDL_SIZE - 1);
+                input->overruns += lost;
+                device->xruns.overruns += lost;
+                input->copied = input->completed - (CAPTURE_BDL_SIZE - 1);
+            }
+            uint32_t slot = input->copied % CAPTURE_BDL_SIZE;
+            char* period = (char*) input->buffers->va + slot * CAPTURE_BUFFER_SIZE;
+            if (input->ring->writable() >= CAPTURE_BUFFER_SIZE) {
+                input->ring->write(period, CAPTURE_BUFFER_SIZE);
+            } else {
+                input->overruns++;
+                device->xruns.overruns++;
+            }
+            input->copied++;
+        }
+        if (input->reader_waiting->exchange(false)) {
+            input->data->up();
+        }
+    }
+}
+
+int audio::audio_record(hda_audio_device* device, char* buffer, uint32_t bytes) {
+    hda_audio_input* input = device->input;
+    if (input == nullptr) return -1;
+
+    LockGuardP g{input->read_lock};
+    if (!input->running) capture_start(device);
+
+    uint32_t done = 0;
+    while (true) {
+        done += input->ring->read(buffer + done, bytes - done);
+        if (done == bytes) break;
+        // the capture thread may have written between our read and the flag
+        input->reader_waiting->set(true);
+        if (input->ring->readable() == 0) {
+            input->data->down();
+        }
+    }
+    return done;
+}
+
+void audio::audio_record_stop(hda_audio_device* device) {
+    hda_audio_input* input = device->input;
+    if (input == nullptr) return;
+
+    LockGuardP g{input->read_lock};
+    if (!input->running) return;
+    REG_OUTB(device, input->sd->base + SD_CTLL, 0);
+    input->running = false;
+    input->ring->skip(input->ring->readable());
+    Debug::printf("| audio: recorded %d periods, %d dropped\n", input->copied, input->overruns);
+}
+
+hda_audio_device* audio::audio_controller() {
+    return primary;
+}
+
+// Binds the first HDA controller (class 4, subclass 3) at boot
+static uint8_t hda_init_device(PCI::pci_device* device) {
+    if (primary != nullptr) return 1;
+    return init_dev(device) == nullptr ? 1 : 0;
+}
+
+PCI::pci_driver audio::hda_pci_driver = {
+    nullptr,
+    (char*) "hda",
+    hda_init_device,
+    nullptr,
+    nullptr,
+    0x0403,
+};
+
+PCI::pci_device* init_dev(PCI::pci_device* device) {
+    // the controller comes up once, a second reset would pull the stream
+    // and the refill thread out from under whoever is playing
+    if (primary != nullptr) return primary->audio->device;
+
+    // the registers are a 16K memory BAR, a 64 bit one has to be below 4G for us
+    uint32_t bar0 = PCI::pci_config_read_dword(device, PCI::PCI_BAR0);
+    bool bar64 = ((bar0 >> 1) & 3) == 2;
+    if ((bar0 & 1) || (bar64 && PCI::pci_config_read_dword(device, PCI::PCI_BAR0 + 4) != 0)) {
+        Debug::printf("| audio: can't reach the registers, BAR0 = %x\n", bar0);
         return nullptr;
     }
+    PCI::pci_enable(device);
+
+    hda_audio_device* hda = new hda_audio_device();
+
+    hda->audio = new audio_device();
+    hda->audio->device = device;
+    hda->audio->driver = hda;
+    hda->audio->recorder = 0;
+    hda->audio->streams = new audio_stream*[8]();
+    hda->output = new hda_audio_output();
+
+    // corb, rirb and the bdls share one frame. Physical memory is
+    // identity mapped in every address space so the refill thread can reach
+    // it (and the DMA buffers) at va == pa
+    hda->rings = new mem_area();
+    hda->rings->size = PhysMem::FRAME_SIZE;
+    hda->rings->pa = new uint32_t[1];
+    hda->rings->pa[0] = PhysMem::alloc_frame();
+    hda->rings->va = (void*) hda->rings->pa[0];
+    hda->corb = (uint32_t*) ((uintptr_t) hda->rings->va + 0);
+    hda->rirb = (uint64_t*) ((uintptr_t) hda->rings->va + 1024);
+    hda->bdl = (audio_bdl_entry*) ((uintptr_t) hda->rings->va + 3072);
+    hda->dma_pos = (uint32_t*) PhysMem::alloc_frame();
+    bzero((void*) hda->dma_pos, PhysMem::FRAME_SIZE);
+    hda->mmap_info = (audio_mmap_info*) ((uintptr_t) hda->dma_pos + AUDIO_MMAP_INFO_OFFSET);
+
+    // the BDL buffers, physically contiguous
+    uint32_t frames = (BDL_SIZE * BUFFER_SIZE) / PhysMem::FRAME_SIZE;
     hda->completed_buffers = new mem_area();
-    if(hda->completed_buffers == nullptr) return nullptr;
+    hda->completed_buffers->size = BDL_SIZE * BUFFER_SIZE;
+    hda->completed_buffers->pa = new uint32_t[frames];
+    hda->completed_buffers->pa[0] = PhysMem::alloc_frames(frames);
+    for (uint32_t i = 1; i < frames; i++) {
+        hda->completed_buffers->pa[i] = hda->completed_buffers->pa[0] + i * PhysMem::FRAME_SIZE;
+    }
+    hda->completed_buffers->va = (void*) hda->completed_buffers->pa[0];
+
+    hda->mmio_base = bar0 & 0xFFFFFFF0;
     hda->mmio = new mem_area();
-    hda->mmio->pa = (uint32_t*)PhysMem::alloc_frame();
-    hda->mmio->va = (void*) 0xFED01000;
-    gheith::map(gheith::current()->pd, (uint32_t)hda->mmio->va, (uint32_t)hda->mmio->pa);
+    hda->mmio->size = 0x4000;
+    hda->mmio->pa = new uint32_t[1];
+    hda->mmio->pa[0] = hda->mmio_base;
+    hda->mmio->va = (void*) VMM::map_device(hda->mmio_base, hda->mmio->size);
+    Debug::printf("| audio: controller %x:%x, registers at %x\n", device->vendor, device->device, hda->mmio_base);
+
+    hda->refill = new Semaphore(0);
+    hda->engine_lock = new BlockingLock();
+    hda->clock_lock = new InterruptSafeLock();
+    hda->verb_lock = new InterruptSafeLock();
 
-    
     audio_reset(hda);
+    stream_pool_init(hda);
     init_output_widget(hda);
+    init_input(hda);
     stream_descriptor_init(hda);
-
-    hda->audio = new audio_device();
-    hda->audio->recorder = 0;
-    hda->audio->streams = new audio_stream*[8];
-
-    hda->output = new hda_audio_output();
-    hda->output->stream = new audio_stream();
-    hda->output->stream->device = new audio_device();
     audio_set_volume(hda->output->stream, 255);
 
-    return hda->audio->device;    
-}
+    hda->mixer = new Mixer(hda);
+    hda->source = hda->mixer;
+
+    primary = hda;
+    // both have a period to finish in, they run ahead of everything else
+    thread([hda] {
+        refill_loop(hda);
+    }, gheith::RT_LEVELS);
+    if (hda->input != nullptr) {
+        thread([hda] {
+            capture_loop(hda);
+        }, gheith::RT_LEVELS);
+    }
 
-int main (int argc, char** argv) {
-    PCI::pci_device* dev = new PCI::pci_device();
-    init_dev(dev);
-    return 0;
+    // everything the handler looks at is set up, from here on nobody polls
+    if (IRQ::route_pci(device, hda_interrupt, hda) >= 0) {
+        hda->rirb_irq = true;
+    } else {
+        Debug::printf("| audio: no interrupt, codec responses are polled and playback can't refill\n");
+    }
+
+    return device;
 }
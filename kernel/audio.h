@@ -7,18 +7,28 @@
 #define _audio_h_
 
 #include "pci.h"
+#include "semaphore.h"
+#include "blocking_lock.h"
+#include "ring.h"
+#include "debug.h"
 
 #define BDL_SIZE 4
 #define BUFFER_SIZE 0x10000
 #define ROUNDED_BDL_BYTES ((BDL_SIZE * sizeof(struct audio_bdl_entry) + 127) & ~127)
 #define BUFFER_SAMPLES (BUFFER_SIZE / 2)
 
+// capture uses shorter periods so recorded data shows up sooner
+#define CAPTURE_BDL_SIZE 4
+#define CAPTURE_BUFFER_SIZE 0x4000
+#define CAPTURE_RING_SIZE 0x40000
+
 extern PCI::pci_device* init_dev(PCI::pci_device* device);
 
 namespace audio {
 
     // HDA Memory Mapped Registers
     enum HDA_REGISTERS {
+        REG_GCAP        = 0x00,     // Global Capabilities
         REG_GCTL        = 0x08,     // Global Control
         REG_WAKEEN      = 0x0c,     // Wake Enable
         REG_STATESTS    = 0x0e,     // State Change Status
@@ -43,14 +53,29 @@ namespace audio {
         REG_DPLBASE     = 0x70,     // DMA Position Lower Base Address
         REG_DPUBASE     = 0x74,     // DMA Posiition Upper Base Address
 
-        REG_O0_CTLL     = 0x100,    // Control Lower
-        REG_O0_CTLU     = 0x102,    // Control Upper
-        REG_O0_STS      = 0x103,    // Status
-        REG_O0_CBL      = 0x108,    // Cyclic Buffer Length
-        REG_O0_STLVI    = 0x10c,    // Last Valid Index
-        REG_O0_FMT      = 0x112,    // Format
-        REG_O0_BDLPL    = 0x118,    // BDL Pointer Lower
-        REG_O0_BDLPU    = 0x11c,    // DL Pointer Upper
+        REG_SD_BASE     = 0x80,     // first stream descriptor, SD_STRIDE apart
+    };
+
+    // Stream descriptor registers, relative to the descriptor. The input
+    // descriptors come first, then the output and then the bidirectional ones.
+    enum HDA_SD_REGISTERS {
+        SD_CTLL         = 0x00,     // Control Lower
+        SD_CTLU         = 0x02,     // Control Upper, stream tag in the high nibble
+        SD_STS          = 0x03,     // Status
+        SD_LPIB         = 0x04,     // Link Position in Buffer
+        SD_CBL          = 0x08,     // Cyclic Buffer Length
+        SD_STLVI        = 0x0c,     // Last Valid Index
+        SD_FMT          = 0x12,     // Format
+        SD_BDLPL        = 0x18,     // BDL Pointer Lower
+        SD_BDLPU        = 0x1c,     // BDL Pointer Upper
+    };
+    constexpr uint32_t SD_STRIDE = 0x20;
+
+    enum HDA_REG_GCAP_BITS {
+        GCAP_OSS_SHIFT  = 12,       // output streams, 4 bits
+        GCAP_ISS_SHIFT  = 8,        // input streams, 4 bits
+        GCAP_BSS_SHIFT  = 3,        // bidirectional streams, 5 bits
+        SD_CTLU_DIR     = (1 << 3), // a bidirectional descriptor is used for output
     };
 
     enum HDA_REG_GCTL_BITS {
@@ -62,20 +87,56 @@ namespace audio {
     };
 
     enum HDA_REG_RIRBCTL_BITS {
+        RIRBCTL_RINTCTL = (1 << 0), // interrupt once RINTCNT responses are in or the codecs go quiet
         RIRBCTL_RIRBRUN = (1 << 1),
     };
 
+    enum HDA_REG_RIRBSTS_BITS {
+        RIRBSTS_RINTFL = (1 << 0), // responses arrived
+        RIRBSTS_RIRBOIS = (1 << 2), // overrun
+    };
+
+    enum HDA_REG_INTCTL_BITS {
+        INTCTL_CIE = (1 << 30), // controller interrupts (RIRB)
+        INTCTL_GIE = (1u << 31),
+    };
+
+    // upper half of a RIRB entry
+    enum HDA_RIRB_EX_BITS {
+        RIRB_EX_CODEC_MASK = 0xf,
+        RIRB_EX_UNSOL = (1 << 4), // unsolicited, not an answer to any verb
+    };
+
     enum HDA_REG_SDCTL_BITS {
+        SDCTL_SRST = 0x1, // stream reset
         SDCTL_RUN = 0x2, // enable dma engine
         SDCTL_IOCE = 0x4, // enable interrupt on complete
     };
 
+    enum HDA_REG_SDSTS_BITS {
+        SDSTS_BCIS = 0x4, // buffer completion interrupt status
+        SDSTS_FIFOE = 0x8, // fifo error
+        SDSTS_DESE = 0x10, // descriptor error
+    };
+
+    // 20, 24 and 32 bit samples all travel in 32 bit containers
     typedef enum {
         AUDIO_16SI = 0,
         AUDIO_8SI,
-        AUDIO_32SI
+        AUDIO_32SI,
+        AUDIO_20SI,
+        AUDIO_24SI
     } audio_sample_format;
 
+    // bytes one sample takes in memory
+    static inline uint32_t audio_sample_bytes(audio_sample_format format) {
+        switch (format) {
+            case AUDIO_8SI: return 1;
+            case AUDIO_16SI: return 2;
+            default: return 4;
+        }
+    }
+
     typedef struct audio_position {
         uint32_t buffer;
         uint32_t frame;
@@ -89,39 +150,227 @@ namespace audio {
     // Buffer Descriptor List
     typedef struct audio_bdl_entry {
         uint32_t addr;
+        uint32_t addr_hi;
         uint32_t length;
         uint32_t flags;
     } audio_bdl_entry;
 
     struct audio_stream;
+    struct hda_audio_device;
+    class Mixer;
 
     typedef struct audio_device {
         PCI::pci_device* device;
+        // the controller driving this device
+        hda_audio_device* driver;
         // does this device record or not
         int recorder;
         // list of streams - should be 8
         audio_stream** streams;
     } audio_device;
 
+    class audio_source;
+
+    // Verbs sent to the codecs together. They go into the CORB as fast as it has
+    // room and the responses come back in the same order, so the RIRB interrupt
+    // matches them to the oldest batch still in flight.
+    typedef struct hda_verb_batch {
+        uint32_t* verbs;
+        uint32_t* responses;    // responses[i] answers verbs[i]
+        uint32_t capacity;
+        uint32_t count;
+        uint32_t sent;          // made it into the CORB
+        uint32_t received;
+        volatile bool complete;
+        Semaphore done;         // upped once every response is in
+        hda_verb_batch* next;
+
+        hda_verb_batch(uint32_t capacity) : verbs(new uint32_t[capacity]), responses(new uint32_t[capacity]()),
+            capacity(capacity), count(0), sent(0), received(0), complete(false), done(0), next(nullptr) {}
+
+        hda_verb_batch(const hda_verb_batch&) = delete;
+
+        ~hda_verb_batch() {
+            delete[] verbs;
+            delete[] responses;
+        }
+
+        // queues a verb, returns the index of its response. The batch
+        // doesn't grow, callers size it for their worst case.
+        uint32_t add(int codec, int node, uint32_t payload) {
+            ASSERT(count < capacity);
+            verbs[count] = ((codec & 0xf) << 28) | ((node & 0xff) << 20) | (payload & 0xfffff);
+            return count++;
+        }
+    } hda_verb_batch;
+
     typedef struct audio_stream {
         audio_device* device;
         uint32_t num_buffers;
         uint32_t buffer_size;
         audio_sample_format sample_format;
+        // mixer state for playback streams
+        audio_source* source;
+        audio_source* input; // what the mixer reads: the source or a resampler around it
+        Semaphore* played; // upped once the last sample has been played
+        uint32_t finished_at; // the mixer fill that found the source empty, 0 while playing
+        bool detached; // nobody waits, the mixer cleans up
     } audio_stream;
 
     // called by a driver whenever a buffer is finished (played or recorded through)
     void audio_buffer_complete(audio_stream* stream, uint32_t buffer);
 
+    // Something the streaming engine can pull PCM data out of. fill() is called
+    // by the refill thread for every buffer the hardware finishes and should
+    // place up to "bytes" bytes in "buffer" (which is DMA memory). It returns
+    // the number of bytes it produced, the engine pads the rest with silence.
+    // Returning 0 means the source is done.
+    class audio_source {
+    public:
+        virtual ~audio_source() {}
+        virtual uint32_t fill(char* buffer, uint32_t bytes) = 0;
+    };
+
+    // Timing of the refill path, all latencies are in TSC cycles
+    typedef struct audio_engine_stats {
+        uint32_t iocs;
+        uint32_t refills;
+        uint32_t late_refills; // refill finished more than half a period after its IOC
+        uint32_t underruns; // the hardware caught up with the refill thread
+        uint64_t total_latency; // IOC -> refill done
+        uint64_t max_latency;
+    } audio_engine_stats;
+
+    // Glitches since the controller came up, never reset. Per stream underruns
+    // are kept by the stream.
+    typedef struct audio_xruns {
+        uint32_t periods;   // output periods played
+        uint32_t underruns; // times the hardware caught up with the refill thread
+        uint32_t silenced;  // periods played as silence instead of stale samples
+        uint32_t overruns;  // captured periods dropped
+    } audio_xruns;
+
+    // Where audio_mmap puts the output's DMA buffers in the process, followed
+    // by one read only page: the controller's DMA positions at the start (8
+    // bytes per stream) and an audio_mmap_info at AUDIO_MMAP_INFO_OFFSET
+    constexpr uint32_t AUDIO_MMAP_VA = 0xF0000000;
+    constexpr uint32_t AUDIO_MMAP_INFO_OFFSET = 0x800;
+
+    typedef struct audio_mmap_info {
+        uint32_t position_index;   // dma_pos[position_index] is where the output plays
+        uint32_t buffer_bytes;     // all of the mapped buffers, the position wraps here
+        uint32_t period_bytes;
+        uint32_t rate;
+        uint32_t channels;         // of 16 bit samples
+        volatile uint32_t periods; // periods the hardware has finished
+    } audio_mmap_info;
+
+    // The playback clock, read from the DMA position buffer. Frames are in the
+    // output's format and count from the start of the stream.
+    typedef struct audio_clock {
+        uint32_t position;  // frames the hardware has played
+        uint32_t queued;    // frames in the DMA buffers that haven't played yet
+        uint32_t jiffies;   // Pit::jiffies when the position was read
+        uint32_t rate;      // frames per second
+    } audio_clock;
+
+    // What probing learned about one widget. It is built once and everything after
+    // that (path selection, volume, formats) reads it instead of asking the codec.
+    typedef struct hda_widget {
+        uint16_t node_id;
+        uint32_t type;            // WIDGET_TYPE
+        uint32_t caps;            // PARAM_AUDIO_WID_CAP
+        uint32_t out_amp_caps;    // the widget's own or the function group's
+        uint32_t in_amp_caps;
+        uint32_t pin_caps;
+        uint32_t pin_control;
+        uint32_t config_default;  // pins: what the board says is behind them
+        uint32_t eapd;
+        uint32_t pcm_caps;        // converters: their own or the function group's
+        uint32_t gain;            // output amp, left << 8 | right
+        uint32_t num_conns;
+        uint16_t* conns;          // inputs, ranges expanded
+        uint32_t selected;        // index into conns
+    } hda_widget;
+
+    typedef struct hda_codec {
+        uint8_t address;
+        uint16_t afg;             // the audio function group
+        uint16_t first_node;
+        uint16_t num_widgets;
+        hda_widget* widgets;      // widgets[i] is node first_node + i
+    } hda_codec;
+
+    // nullptr if the node isn't one of the codec's widgets
+    static inline hda_widget* codec_widget(hda_codec* codec, uint32_t node_id) {
+        uint32_t i = node_id - codec->first_node;
+        return (i < codec->num_widgets) ? &codec->widgets[i] : nullptr;
+    }
+
+    constexpr uint32_t MAX_PATH_LEN = 8;
+
+    // A route through a codec from a pin back to the converter feeding it
+    typedef struct hda_path {
+        hda_codec* codec;
+        uint32_t length;
+        hda_widget* widgets[MAX_PATH_LEN]; // the pin first, the converter last
+        uint32_t conn[MAX_PATH_LEN]; // widgets[i + 1] is widgets[i]->conns[conn[i]]
+    } hda_path;
+
+    // One of the controller's stream descriptors
+    typedef struct hda_stream_desc {
+        uint32_t index;     // among all descriptors: INTSTS bit, DMA position entry
+        uint32_t base;      // register offset
+        uint8_t tag;        // what the converter listens for, unique per direction
+        bool output;        // what it is used for, bidirectional ones can do either
+        bool bidir;
+        bool in_use;
+    } hda_stream_desc;
+
     typedef struct hda_audio_output {
         audio_stream* stream;
+        hda_stream_desc* sd; // the descriptor the engine plays through
+        hda_widget* dac; // the converter in the codec graph
+        hda_path path; // how it gets to the pin
+        hda_widget* volume; // the amp closest to the converter, nullptr if the path has none
         uint8_t codec;
         uint16_t node_id;
-        uint32_t sample_rate;
+        uint32_t sample_rate; // Hz
+        audio_sample_format sample_format;
         int amp_gain;
         int num_channels;
+        int max_channels; // what the converter takes
+        uint32_t pcm_caps; // PARAM_PCM_SIZE_RATE of the converter
+        uint16_t format; // the SDnFMT / converter format we programmed
     } hda_audio_output;
 
+    // The capture side: an input pin routed to an ADC whose stream DMAs
+    // periods into "buffers". The capture thread moves every finished period
+    // into "ring" where audio_record picks it up.
+    typedef struct hda_audio_input {
+        audio_stream* stream;
+        hda_stream_desc* sd;
+        hda_widget* adc;
+        hda_path path; // the ADC first, the pin last
+        uint8_t codec;
+        uint16_t node_id;
+        uint32_t sample_rate;
+        int num_channels;
+        uint16_t format;
+
+        struct mem_area* buffers;
+        audio_bdl_entry* bdl;
+        SpscRing* ring;
+        Semaphore* period; // upped for every period the hardware finishes
+        Semaphore* data; // upped when a waiting reader has something to read
+        Atomic<bool>* reader_waiting;
+        BlockingLock* read_lock; // one reader at a time, the ring has one consumer
+        volatile bool running;
+        volatile uint32_t completed; // periods the hardware has finished since the start
+        uint32_t copied; // and how many of those the capture thread moved to the ring
+        uint32_t overruns; // periods dropped because nobody read the ring or we fell behind
+    } hda_audio_input;
+
     typedef struct mem_area {
         uint32_t size;
         void* va;
@@ -132,25 +381,124 @@ namespace audio {
     typedef struct hda_audio_device {
         audio_device* audio;
         hda_audio_output* output;
+        hda_audio_input* input; // nullptr if no input pin leads to an ADC
+
+        // stream descriptors, counted from GCAP
+        uint32_t iss, oss, bss;
+        hda_stream_desc* sds; // iss + oss + bss of them
+        InterruptSafeLock* sd_lock;
         
         mem_area* mmio;
         uintptr_t mmio_base;
 
         mem_area* rings; // Memory space for each ring buffer
         uint32_t* corb; // corb buffer
-        volatile uint32_t* rirb; // rirb buffer
-        audio_bdl_entry** bdl; // buffer descriptor list
-        volatile uint32_t* dma_pos; // dma position in buffer
+        volatile uint64_t* rirb; // rirb buffer, response and codec/unsolicited bits
+        audio_bdl_entry* bdl; // buffer descriptor list
+        volatile uint32_t* dma_pos; // dma position in buffer, a frame of its own so it can be mapped
+        audio_mmap_info* mmap_info; // the kernel's part of that frame
+        uint32_t* mapped_by; // page directory of the process that owns the output buffers
 
         uint32_t corb_entries;
         uint32_t rirb_entries;
         uint16_t rirb_rp; // rirb read pointer
 
+        hda_codec* codecs[15]; // by address, nullptr where no codec answered
+
+        // codec verbs
+        InterruptSafeLock* verb_lock; // guards the batches and both rings
+        hda_verb_batch* verbs_head; // oldest batch still missing responses
+        hda_verb_batch* verbs_tail;
+        uint32_t verbs_in_flight; // in the CORB without a response yet
+        volatile bool rirb_irq; // responses come in by interrupt, otherwise waiters poll
+        uint32_t verbs_sent;
+        uint32_t batches_sent;
+        uint32_t unsolicited;
+
         mem_area* completed_buffers;
         int num_buffs_completed;
 
+        // streaming engine
+        audio_source* source; // where the refill thread gets its samples (the mixer)
+        Mixer* mixer;
+        Semaphore* refill; // upped once for every buffer the hardware finishes
+        BlockingLock* engine_lock; // guards starting and stopping the DMA engine
+        uint32_t next_slot; // the BDL slot the refill thread fills next
+        uint32_t silent_slots; // consecutive slots refilled with nothing but silence
+        volatile bool running;
+        volatile uint64_t ioc_tsc[BDL_SIZE]; // when each slot last finished playing
+        audio_engine_stats stats;
+
+        // playback clock, the position buffer only gives the offset in the cyclic buffer
+        InterruptSafeLock* clock_lock;
+        uint64_t played_base; // bytes played before the current trip around the buffer
+        uint32_t last_dma_pos;
+        uint64_t written; // bytes handed to the DMA engine since the stream started
+
+        // xrun detection, both count periods since the stream started
+        volatile uint32_t periods_played; // IOCs
+        volatile uint32_t periods_filled; // refills, the hardware must stay behind this
+        audio_xruns xruns;
+
     } hda_audio_device;
 
+    // the controller set up by init_dev
+    extern hda_audio_device* primary;
+
+    // returns the controller bound at boot, nullptr if there is none
+    extern hda_audio_device* audio_controller();
+
+    // matches HDA controllers, kernelMain registers it after pci_init
+    extern PCI::pci_driver hda_pci_driver;
+
+    // Starts the DMA engine if it isn't running. It stops on its own once the
+    // source has produced nothing for BDL_SIZE periods.
+    extern void audio_start(hda_audio_device* device);
+
+    // Stops the DMA engine now if it is running, whatever is still queued
+    // in the buffers doesn't get played
+    extern void audio_stop(hda_audio_device* device);
+
+    // Plays everything "source" produces next to whatever else is playing,
+    // blocks until the last sample has been played. Returns -1 if the
+    // stream can't be opened.
+    extern int audio_play(hda_audio_device* device, audio_source* source, uint32_t rate, uint32_t channels,
+        audio_sample_format format);
+
+    // Hands the output DMA buffers to one process: stops the mixer, switches to
+    // 16 bit samples at the closest rate and channel count the codec has and
+    // maps the buffers and the position page at AUDIO_MMAP_VA. The engine runs
+    // without refilling anything, the process writes ahead of the position.
+    // Returns AUDIO_MMAP_VA or 0 if streams are playing or it is mapped already.
+    extern uint32_t audio_mmap(hda_audio_device* device, uint32_t* pd, uint32_t rate, uint32_t channels);
+
+    // Stops the engine and takes the mapping away again, nothing if pd doesn't own it
+    extern void audio_munmap(hda_audio_device* device, uint32_t* pd);
+
+    // Takes a free descriptor for the given direction, an input or output one
+    // before a bidirectional one, with a stream tag nobody else uses in that
+    // direction. Its interrupt is enabled. nullptr if they are all in use.
+    extern hda_stream_desc* stream_alloc(hda_audio_device* device, bool output);
+    extern void stream_free(hda_audio_device* device, hda_stream_desc* sd);
+
+    // Reads the playback clock. Everything but the rate and jiffies is 0 while
+    // the engine is stopped.
+    extern void audio_get_clock(hda_audio_device* device, audio_clock* clock);
+
+    // Blocks until "bytes" bytes of captured PCM are in "buffer", starting the
+    // capture stream if it isn't running. The data is in the input's format.
+    // Returns -1 if there is nothing to record from.
+    extern int audio_record(hda_audio_device* device, char* buffer, uint32_t bytes);
+
+    // Stops capturing and throws away whatever wasn't read
+    extern void audio_record_stop(hda_audio_device* device);
+
+    // Sends the batch without waiting for the responses
+    extern void codec_submit(hda_audio_device* device, hda_verb_batch* batch);
+
+    // Blocks until every response of a submitted batch is in
+    extern void codec_wait(hda_audio_device* device, hda_verb_batch* batch);
+
     // place a given double word value into a register
     static inline void REG_OUTL(hda_audio_device* device, uint32_t reg, uint32_t val) {
         volatile uint32_t* mmio = (uint32_t*)((uint8_t*)device->mmio->va + reg);
@@ -197,6 +545,7 @@ namespace audio {
         VERB_GET_CONFIG_DEFAULT = 0xf1c00,
         VERB_GET_CONN_LIST      = 0xf0200,
         VERB_GET_CONN_SELECT    = 0xf0100,
+        VERB_SET_CONN_SELECT    = 0x70100,
         VERB_GET_PIN_CONTROL    = 0xf0700,
         VERB_SET_PIN_CONTROL    = 0x70700,
         VERB_GET_EAPD_BTL       = 0xf0c00,
@@ -210,7 +559,9 @@ namespace audio {
         PARAM_NODE_COUNT        = 0x04,
         PARAM_FN_GROUP_TYPE     = 0x05,
         PARAM_AUDIO_WID_CAP     = 0x09,
+        PARAM_PCM_SIZE_RATE     = 0x0a,
         PARAM_PIN_CAP           = 0x0c,
+        PARAM_IN_AMP_CAP        = 0x0d,
         PARAM_CONN_LIST_LEN     = 0x0e,
         PARAM_OUT_AMP_CAP       = 0x12,
     };
@@ -232,27 +583,81 @@ namespace audio {
     };
 
     enum WIDGET_CAP {
+        WIDGET_CAP_STEREO       = (1 << 0),
+        WIDGET_CAP_IN_AMP       = (1 << 1),
+        WIDGET_CAP_OUT_AMP      = (1 << 2),
+        WIDGET_CAP_AMP_OVR      = (1 << 3),   // has its own amp caps
+        WIDGET_CAP_FORMAT_OVR   = (1 << 4),   // has its own PARAM_PCM_SIZE_RATE
         WIDGET_CAP_POWER_CNTRL  = (1 << 10),
+        WIDGET_CAP_CHAN_EXT_SHIFT = 13,
+        WIDGET_CAP_CHAN_EXT_MASK = (0x7 << 13),
         WIDGET_CAP_TYPE_SHIFT   = 20,
         WIDGET_CAP_TYPE_MASK    = (0xf << 20),
     };
 
     enum PIN_CAP {
+        PIN_CAP_HP_DRIVE        = (1 << 3),
         PIN_CAP_OUTPUT          = (1 << 4),
         PIN_CAP_INPUT           = (1 << 5),
+        PIN_CAP_EAPD            = (1 << 16),
     };
 
     enum PIN_CTL_FLAGS {
+        PIN_CTL_ENABLE_INPUT    = (1 << 5),
         PIN_CTL_ENABLE_OUTPUT   = (1 << 6),
+        PIN_CTL_ENABLE_HP       = (1 << 7),
+    };
+
+    // configuration default of a pin
+    enum CONFIG_DEFAULT {
+        CONFIG_PORT_SHIFT       = 30,
+        CONFIG_PORT_NONE        = 1,        // nothing is connected
+        CONFIG_DEVICE_SHIFT     = 20,
+        CONFIG_DEVICE_MASK      = 0xf,
+        CONFIG_DEVICE_LINE_OUT  = 0x0,
+        CONFIG_DEVICE_SPEAKER   = 0x1,
+        CONFIG_DEVICE_HP_OUT    = 0x2,
+        CONFIG_DEVICE_LINE_IN   = 0x8,
+        CONFIG_DEVICE_MIC_IN    = 0xa,
     };
 
+    // payload of VERB_SET_AMP_GAIN_MUTE
+    enum AMP_GAIN_BITS {
+        AMP_SET_OUTPUT          = (1 << 15),
+        AMP_SET_INPUT           = (1 << 14),
+        AMP_SET_LEFT            = (1 << 13),
+        AMP_SET_RIGHT           = (1 << 12),
+        AMP_SET_INDEX_SHIFT     = 8,
+        AMP_MUTE                = (1 << 7),
+        AMP_CAP_OFFSET_MASK     = 0x7f,     // the step that is 0dB
+    };
+
+    // stream format: rate = base * mult / div
     enum SAMPLE_FORMAT {
         SR_48_KHZ               = 0,
         SR_44_KHZ               = (1 << 14),
-        BITS_32                 = (4 <<  4),
+        SR_MULT_SHIFT           = 11,       // mult - 1, 1 to 4
+        SR_DIV_SHIFT            = 8,        // div - 1, 1 to 8
+        BITS_8                  = (0 <<  4),
         BITS_16                 = (1 <<  4),
+        BITS_20                 = (2 <<  4),
+        BITS_24                 = (3 <<  4),
+        BITS_32                 = (4 <<  4),
+    };
+
+    // PARAM_PCM_SIZE_RATE, bits 0 to 11 are the rates in the order of the table in audio.cc
+    enum PCM_CAP {
+        PCM_BITS_8              = (1 << 16),
+        PCM_BITS_16             = (1 << 17),
+        PCM_BITS_20             = (1 << 18),
+        PCM_BITS_24             = (1 << 19),
+        PCM_BITS_32             = (1 << 20),
     };
 }
 
 
+extern int audio_set_sample_rate(audio::audio_stream* stream, int sr);
+extern int audio_set_chnl_ct(audio::audio_device* dev, int channels);
+extern int audio_set_sample_format(audio::audio_device* dev, audio::audio_sample_format format);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,76 @@
+#include "bench.h"
+
+#ifdef KERNEL_BENCH
+
+#include "stdint.h"
+#include "machine.h"
+#include "debug.h"
+#include "libk.h"
+
+namespace Bench {
+
+    // what memcpy and bzero used to do, volatile keeps the compiler from
+    // turning them back into calls
+    static void copy_bytes(void* dest, const void* src, size_t n) {
+        volatile char* d = (volatile char*) dest;
+        const volatile char* s = (const volatile char*) src;
+        for (size_t i = 0; i < n; i++) d[i] = s[i];
+    }
+
+    static void zero_bytes(void* dest, size_t n) {
+        volatile char* d = (volatile char*) dest;
+        for (size_t i = 0; i < n; i++) d[i] = 0;
+    }
+
+    constexpr uint32_t MAX = 64 * 1024;
+    constexpr uint32_t BYTES = 4 * 1024 * 1024; // moved per measurement
+
+    // bytes per cycle times 100, the best of 3 runs
+    template <typename F>
+    static uint32_t measure(uint32_t n, F f) {
+        uint64_t best = ~uint64_t(0);
+        for (int run = 0; run < 3; run++) {
+            uint64_t start = rdtsc();
+            for (uint32_t done = 0; done < BYTES; done += n) f();
+            uint64_t cycles = rdtsc() - start;
+            if (cycles < best) best = cycles;
+        }
+        return K::div64((uint64_t) BYTES * 100, best == 0 ? 1 : best);
+    }
+
+    static void report(const char* what, uint32_t n, uint32_t offset, uint32_t before, uint32_t after) {
+        Debug::printf("| bench: %s %d bytes, dest +%d: %d.%d%d -> %d.%d%d bytes/cycle\n", what, n, offset,
+            before / 100, (before / 10) % 10, before % 10, after / 100, (after / 10) % 10, after % 10);
+    }
+
+    void copy() {
+        char* src = new char[MAX + 8];
+        char* dest = new char[MAX + 8];
+        for (uint32_t i = 0; i < MAX + 8; i++) src[i] = i;
+
+        uint32_t sizes[] = { 64, 512, 4096, MAX };
+        for (uint32_t n : sizes) {
+            // aligned and the worst case for word copies
+            for (uint32_t offset = 0; offset < 2; offset++) {
+                char* d = dest + offset * 3;
+                uint32_t before = measure(n, [=] { copy_bytes(d, src, n); });
+                uint32_t after = measure(n, [=] { memcpy(d, src, n); });
+                report("memcpy", n, offset * 3, before, after);
+            }
+            uint32_t before = measure(n, [=] { zero_bytes(dest, n); });
+            uint32_t after = measure(n, [=] { bzero(dest, n); });
+            report("bzero", n, 0, before, after);
+        }
+
+        delete[] src;
+        delete[] dest;
+    }
+}
+
+#else
+
+namespace Bench {
+    void copy() {}
+}
+
+#endif
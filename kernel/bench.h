@@ -0,0 +1,13 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+// Microbenchmarks, only built with -DKERNEL_BENCH
+// (make UTCS_OPT="-O3 -DKERNEL_BENCH"). kernelMain runs them before
+// mounting the disk and prints the results.
+
+namespace Bench {
+    // memcpy and bzero against the byte at a time loops they replaced
+    extern void copy();
+}
+
+#endif
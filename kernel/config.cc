@@ -60,6 +60,16 @@ struct IOAPIC_ENTRY {
 
 typedef struct IOAPIC_ENTRY IOAPIC_ENTRY;
 
+struct OVERRIDE_ENTRY {
+    MADT_ENTRY madt;
+    uint8_t bus;
+    uint8_t source;
+    uint32_t gsi;
+    uint16_t flags;
+} __attribute__ ((packed));
+
+typedef struct OVERRIDE_ENTRY OVERRIDE_ENTRY;
+
 struct RSD {
     char Signature[8];
     uint8_t Checksum;
@@ -145,6 +155,7 @@ void configInit(Config* config) {
     MADT_ENTRY* entryPtr = (MADT_ENTRY*)(madt + 1);
 
     config->nOtherProcs = 0; // Base processor not in tables
+    config->nOverrides = 0;
 
     while (bytesForEntries > 0) {
         uint32_t len = entryPtr->len;
@@ -168,6 +179,15 @@ void configInit(Config* config) {
             // Debug::printf("ID: %d, address: 0x%x, base: %d\n", apic->apicId, apic->address, apic->base);
             config->ioAPIC = apic->address;
         }
+        else if (entryPtr->type == 2) {
+            OVERRIDE_ENTRY *o = (OVERRIDE_ENTRY*) entryPtr;
+            if (config->nOverrides < MAX_OVERRIDES) {
+                IrqOverride * info = &config->overrides[config->nOverrides ++];
+                info->source = o->source;
+                info->gsi = o->gsi;
+                info->flags = o->flags;
+            }
+        }
     }
 
     config->totalProcs = config->nOtherProcs + 1;
@@ -11,7 +11,18 @@ struct ApicInfo {
 
 typedef struct ApicInfo ApicInfo;
 
+// An ISA interrupt that isn't wired to the IOAPIC pin of the same number
+// or with the bus default polarity and trigger mode
+struct IrqOverride {
+    uint8_t source;
+    uint32_t gsi;
+    uint16_t flags;     // polarity in bits 1:0 (1 high, 3 low), trigger in 3:2 (1 edge, 3 level), 0 is the bus default
+};
+
+typedef struct IrqOverride IrqOverride;
+
 #define MAX_PROCS 16
+#define MAX_OVERRIDES 16
 
 struct Config {
     uint32_t memSize;
@@ -22,6 +33,8 @@ struct Config {
     uint32_t ioAPIC;
 
     ApicInfo apicInfo[MAX_PROCS];
+    uint32_t nOverrides;
+    IrqOverride overrides[MAX_OVERRIDES];
     char oemid[7];
 };
 
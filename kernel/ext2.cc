@@ -135,6 +135,19 @@ void Node::get_symbol(char* buffer) {
     }
 }
 
+uint32_t Node::map_entry(uint32_t level, uint32_t block, uint32_t i) {
+    LockGuard g{map_lock};
+    if (map_cache[level] == nullptr) {
+        map_cache[level] = new uint32_t[block_size / 4];
+    } else if (map_cache_block[level] == block) {
+        return map_cache[level][i];
+    }
+    auto cnt = ide->read_all(block * block_size, block_size, (char*) map_cache[level]);
+    ASSERT(cnt == block_size);
+    map_cache_block[level] = block;
+    return map_cache[level][i];
+}
+
 void Node::read_block(uint32_t index, char* buffer) {
     ASSERT(index < data.n_sectors / (block_size / 512));
 
@@ -145,12 +158,16 @@ void Node::read_block(uint32_t index, char* buffer) {
     if (index < 12) {
         uint32_t* direct = &data.direct0;
         block_index = direct[index];
-    } else if (index < (12 + refs_per_block)) {
-        ide->read(data.indirect_1 * block_size + (index - 12) * 4,block_index);
-
+    } else if ((index -= 12) < refs_per_block) {
+        block_index = map_entry(0, data.indirect_1, index);
+    } else if ((index -= refs_per_block) < refs_per_block * refs_per_block) {
+        auto l1 = map_entry(1, data.indirect_2, index / refs_per_block);
+        block_index = map_entry(0, l1, index % refs_per_block);
     } else {
-        block_index = 0;
-        Debug::panic("index = %d\n",index);
+        index -= refs_per_block * refs_per_block;
+        auto l2 = map_entry(2, data.indirect_3, index / (refs_per_block * refs_per_block));
+        auto l1 = map_entry(1, l2, (index / refs_per_block) % refs_per_block);
+        block_index = map_entry(0, l1, index % refs_per_block);
     }
 
     auto cnt = ide->read_all(block_index * block_size, block_size,buffer);
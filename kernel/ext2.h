@@ -4,6 +4,8 @@
 #include "ide.h"
 #include "shared.h"
 #include "atomic.h"
+#include "slab.h"
+#include "blocking_lock.h"
 
 struct SuperBlock {
     uint32_t inodes_count;
@@ -114,6 +116,18 @@ class Node : public BlockIO { // we implement BlockIO because we
     Shared<Ide> ide;
     Atomic<uint32_t> ref_count;
 
+    // The most recently used indirect block at each level (0 is the one
+    // pointing at data blocks). Sequential reads hit these almost every time
+    // so mapping a block doesn't cost a disk read and a temporary buffer.
+    // Readers of the same file share them, so they are only touched
+    // with map_lock held (it sleeps across the disk read).
+    BlockingLock map_lock{};
+    uint32_t* map_cache[3] = {};
+    uint32_t map_cache_block[3] = {};
+
+    // returns entry "i" of indirect block "block"
+    uint32_t map_entry(uint32_t level, uint32_t block, uint32_t i);
+
 public:
 
     // i-number of this node
@@ -124,7 +138,14 @@ public:
 
     }
 
-    virtual ~Node() {}
+    virtual ~Node() {
+        for (uint32_t i = 0; i < 3; i++) {
+            delete[] map_cache[i];
+        }
+    }
+
+    static void* operator new(size_t size) { return Slab::nodes.alloc(size); }
+    static void operator delete(void* p, size_t size) { Slab::nodes.free(p, size); }
 
     // How many bytes does this i-node represent
     //    - for a file, the size of the file
@@ -38,6 +38,16 @@ public:
         return t;
     }
 
+    // get() that waits at most timeout jiffies, false if it's still not set
+    bool get(T& out, uint32_t timeout) {
+        if (!isReady) {
+            if (!go.down(timeout)) return false;
+            go.up();
+        }
+        out = t;
+        return true;
+    }
+
     friend class Shared<Future<T>>;
 };
 
@@ -3,8 +3,16 @@
 #include "stdint.h"
 #include "blocking_lock.h"
 #include "atomic.h"
+#include "smp.h"
+#include "libk.h"
+#include "physmem.h"
 
-/* A first-fit heap */
+/* A first-fit heap with per-CPU caches of small blocks in front */
+
+/* heapInit gives us the first region, more come from PhysMem when that
+   runs out. Every region is bracketed by two taken 2-int blocks so
+   coalescing never crosses into whatever sits between regions, and all
+   indices are relative to the first one. */
 
 
 namespace gheith {
@@ -137,18 +145,48 @@ void heapInit(void* base, size_t bytes) {
     theLock = new BlockingLock();
 }
 
-void* malloc(size_t bytes) {
-    using namespace gheith;
-    //Debug::printf("malloc(%d)\n",bytes);
-    if (bytes == 0) return (void*) array;
+namespace gheith {
 
-    int ints = ((bytes + 3) / 4) + 2;
-    if (ints < 4) ints = 4;
+// Size classes. Small blocks are still ordinary first-fit blocks (the
+// header tells free how big they are) but freed ones wait in a per-CPU
+// list for the next malloc of the same class instead of going back to the
+// free list. Only refills, overflows and big blocks take the heap lock.
+constexpr static int CLASSES = 14;
+constexpr static uint32_t class_bytes[CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
+constexpr static uint32_t MAX_SMALL = 2048;
+constexpr static uint32_t CACHE_LIMIT = 32;     // blocks per class per CPU
 
-    LockGuardP g{theLock};
+struct FreeBlock {
+    FreeBlock* next;
+};
 
-    void* res = 0;
+struct ClassCache {
+    FreeBlock* head[CLASSES];
+    uint32_t count[CLASSES];
+};
 
+static PerCPU<ClassCache> caches;
+
+// smallest class that fits a request
+static int class_for(size_t bytes) {
+    for (int c = 0; c < CLASSES; c++) {
+        if (bytes <= class_bytes[c]) return c;
+    }
+    return -1;
+}
+
+// largest class a block can serve, first-fit can leave up to 12 extra bytes
+static int class_of(uint32_t bytes) {
+    if (bytes > MAX_SMALL + 12) return -1;
+    int c = CLASSES - 1;
+    while (class_bytes[c] > bytes) c--;
+    return c;
+}
+
+// called with the lock held, returns the header index or 0
+static int find(int ints) {
     int mx = 0x7FFFFFFF;
     int it = 0;
 
@@ -182,20 +220,91 @@ void* malloc(size_t bytes) {
         } else {
             makeTaken(it,mx);
         }
-        res = &array[it+1];
     }
 
-    return res;
+    return it;
 }
 
-void free(void* p) {
-    using namespace gheith;
-    if (p == 0) return;
-    if (p == (void*) array) return;
+constexpr static uint32_t GROW_FRAMES = 256;     // at least 1MB at a time
 
-    LockGuardP g{theLock};
+// the header of an empty grown region we hold on to so a burst of
+// allocations that comes and goes doesn't bounce megabytes through PhysMem
+static int spare = 0;
 
-    int idx = ((((uintptr_t) p) - ((uintptr_t) array)) / 4) - 1;
+// add a region with room for a block of "ints", called with the lock held
+static bool grow(int ints) {
+    if (!PhysMem::ready()) return false;
+
+    // in frames without going through bytes, that can overflow
+    uint32_t per_frame = PhysMem::FRAME_SIZE / 4;
+    uint32_t frames = ((uint32_t) ints + 4 + per_frame - 1) / per_frame;
+    if (frames < GROW_FRAMES) frames = GROW_FRAMES;
+
+    // regions are whole buddy blocks so they go back in one piece. The
+    // largest allocation is whatever PhysMem has in one block.
+    uint32_t order = 0;
+    while ((1u << order) < frames) order++;
+    if (order > PhysMem::MAX_ORDER) return false;
+    uint32_t pa = PhysMem::alloc_block(order);
+    if (pa == 0) return false;
+
+    int start = (pa - (uint32_t) array) / 4;
+    int end = start + (PhysMem::FRAME_SIZE << order) / 4;
+
+    makeTaken(start,2);
+    makeAvail(start+2,end-start-4);
+    makeTaken(end-2,2);
+    if (end > len) len = end;
+
+    return true;
+}
+
+// is idx a free block that fills a whole grown region
+static bool empty_region(int idx) {
+    return isAvail(idx) && array[idx-1] == -2 && array[idx+size(idx)] == -2;
+}
+
+// a grown region that is completely free again goes back to PhysMem
+// unless we don't have a spare, called with the lock held
+static void shrink(int idx) {
+    int sz = size(idx);
+    int start = idx - 2;
+    int end = idx + sz + 2;
+
+    // only the sentinels are 2 ints long, the first region stays
+    if (start == 0 || !empty_region(idx)) return;
+
+    // the first block of a region always starts at the same index, the
+    // spare has been used since if that block isn't the whole region.
+    // Only a region of the usual size is worth keeping, a big buffer's
+    // region goes back as soon as the buffer does.
+    uint32_t frames = ((end - start) * 4) / PhysMem::FRAME_SIZE;
+    if (idx == spare) return;
+    if (frames == GROW_FRAMES && (spare == 0 || !empty_region(spare))) {
+        spare = idx;
+        return;
+    }
+
+    remove(idx);
+    uint32_t order = 0;
+    while ((1u << order) < frames) order++;
+    PhysMem::dealloc_block((uint32_t) &array[start], order);
+}
+
+// called with the lock held, returns the header index or 0
+static int take(int ints) {
+    int it = find(ints);
+    if (it == 0 && grow(ints)) it = find(ints);
+    return it;
+}
+
+static int index_of(void* p) {
+    return ((((uintptr_t) p) - ((uintptr_t) array)) / 4) - 1;
+}
+
+// called with the lock held
+static void give(void* p) {
+    int idx = index_of(p);
     sanity(idx);
     if (!isTaken(idx)) {
         Debug::panic("freeing free block, p:%x idx:%d\n",(uint32_t) p,(int32_t) idx);
@@ -219,6 +328,118 @@ void free(void* p) {
     }
 
     makeAvail(idx,sz);
+    shrink(idx);
+}
+
+static int ints_for(size_t bytes) {
+    int ints = ((bytes + 3) / 4) + 2;
+    if (ints < 4) ints = 4;
+    return ints;
+}
+
+};
+
+void* malloc(size_t bytes) {
+    using namespace gheith;
+    //Debug::printf("malloc(%d)\n",bytes);
+    if (bytes == 0) return (void*) array;
+
+    int c = class_for(bytes);
+    if (c < 0) {
+        LockGuardP g{theLock};
+        int it = take(ints_for(bytes));
+        return (it == 0) ? nullptr : &array[it+1];
+    }
+
+    FreeBlock* p;
+    {
+        bool was = Interrupts::disable();
+        ClassCache& cache = caches.forCPU(SMP::early_me());
+        p = cache.head[c];
+        if (p != nullptr) {
+            cache.head[c] = p->next;
+            cache.count[c]--;
+        }
+        Interrupts::restore(was);
+    }
+    if (p != nullptr) return p;
+
+    // empty, get a few at once so the next ones don't need the lock
+    uint32_t batch = K::min(8u, 4096 / class_bytes[c]);
+    int ints = ints_for(class_bytes[c]);
+    FreeBlock* got = nullptr;
+    uint32_t n = 0;
+    {
+        LockGuardP g{theLock};
+        while (n < batch) {
+            int it = take(ints);
+            if (it == 0) break;
+            FreeBlock* b = (FreeBlock*) &array[it+1];
+            b->next = got;
+            got = b;
+            n++;
+        }
+    }
+    if (got == nullptr) return nullptr;
+
+    p = got;
+    got = got->next;
+    if (got != nullptr) {
+        bool was = Interrupts::disable();
+        ClassCache& cache = caches.forCPU(SMP::early_me());
+        FreeBlock* last = got;
+        while (last->next != nullptr) last = last->next;
+        last->next = cache.head[c];
+        cache.head[c] = got;
+        cache.count[c] += n - 1;
+        Interrupts::restore(was);
+    }
+
+    return p;
+}
+
+void free(void* p) {
+    using namespace gheith;
+    if (p == 0) return;
+    if (p == (void*) array) return;
+
+    int idx = index_of(p);
+    int c = class_of((size(idx) - 2) * 4);
+    if (c < 0) {
+        LockGuardP g{theLock};
+        give(p);
+        return;
+    }
+
+    // too many cached, hand half of them back
+    FreeBlock* extra = nullptr;
+    {
+        bool was = Interrupts::disable();
+        ClassCache& cache = caches.forCPU(SMP::early_me());
+        FreeBlock* b = (FreeBlock*) p;
+        b->next = cache.head[c];
+        cache.head[c] = b;
+        cache.count[c]++;
+        if (cache.count[c] > CACHE_LIMIT) {
+            while (cache.count[c] > CACHE_LIMIT / 2) {
+                b = cache.head[c];
+                cache.head[c] = b->next;
+                cache.count[c]--;
+                b->next = extra;
+                extra = b;
+            }
+        }
+        Interrupts::restore(was);
+    }
+
+    if (extra != nullptr) {
+        LockGuardP g{theLock};
+        while (extra != nullptr) {
+            FreeBlock* b = extra;
+            extra = extra->next;
+            give(b);
+        }
+    }
 }
 
 
@@ -4,6 +4,10 @@
 #include "stdint.h"
 
 extern void heapInit(void* start, size_t bytes);
+
+// nullptr if there's no room. The heap grows by blocks of contiguous
+// physical memory, so one allocation can be as big as the largest free
+// block PhysMem has (rounded up to a power of 2 frames), up to 2GB.
 extern "C" void* malloc(size_t size);
 extern "C" void free(void* p);
 
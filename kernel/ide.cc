@@ -5,6 +5,8 @@
 #include "threads.h"
 #include "atomic.h"
 #include "smp.h"
+#include "irq.h"
+#include "semaphore.h"
 
 // The drive number encodes the controller in bit 1 and the channel in bit 0
 
@@ -57,6 +59,34 @@ static void waitForDrive(uint32_t drive) {
     }
 }
 
+// Each controller interrupts once a sector is ready (IRQ 14 and 15). Readers
+// sleep on the semaphore instead of spinning on BSY; without a route they poll.
+static Semaphore* irqDone[2];
+static bool irqRouted[2];
+static BlockingLock irqSetup{};
+
+static void ideInterrupt(void* arg) {
+    uint32_t c = (uint32_t) arg;
+    // reading the status register acknowledges the interrupt
+    inb(ports[c] + 7);
+    irqDone[c]->up();
+}
+
+// both drives on a controller share the route, whoever comes first sets it up
+static void routeInterrupt(uint32_t drive) {
+    uint32_t c = controller(drive);
+    LockGuard g{irqSetup};
+    if (irqDone[c] != nullptr) return;
+    irqDone[c] = new Semaphore(0);
+    // nIEN clear in device control, the drive raises its interrupt
+    outb(ports[c] + 0x206, 0);
+    irqRouted[c] = IRQ::route_isa(14 + c, ideInterrupt, (void*) c) >= 0;
+}
+
+Ide::Ide(uint32_t drive) : BlockIO(sector_size), drive(drive), ref_count(0) {
+    routeInterrupt(drive);
+}
+
 static uint32_t nRead = 0;
 static uint32_t nWrite = 0;
 
@@ -77,6 +107,10 @@ void Ide::read_block(uint32_t sector, char* buffer) {
     outb(base + 6, 0xE0 | (ch << 4) | ((sector >> 24) & 0xf));
     outb(base + 7, 0x20);		// read with retry
 
+    if (irqRouted[controller(drive)]) {
+        // a stray up only means we end up polling below
+        irqDone[controller(drive)]->down();
+    }
     waitForDrive(drive);
 
     while ((getStatus(drive) & DRQ) == 0) {
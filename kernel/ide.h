@@ -5,6 +5,7 @@
 #include "block_io.h"
 #include "atomic.h"
 #include "shared.h"
+#include "blocking_lock.h"
 
 // Simple (way too simple) device driver for IDE devices (mostly disks)
 //
@@ -21,12 +22,14 @@ class Ide : public BlockIO {  // We are a block device
     
     uint32_t drive; /* 0 -> A, 1 -> B, 2 -> C, 3 -> D */
 
-    InterruptSafeLock lock;
+    BlockingLock lock;      // we sleep while the drive works
 
     Atomic<uint32_t> ref_count;
 
 public:
-    Ide(uint32_t drive) : BlockIO(sector_size), drive(drive), ref_count(0) {}
+    // the first drive made on a controller routes its interrupt, so
+    // read_block doesn't have to check
+    Ide(uint32_t drive);
 
     virtual ~Ide() {}
     
@@ -15,6 +15,7 @@
 #include "stdint.h"
 #include "tss.h"
 #include "sys.h"
+#include "irq.h"
 
 struct Stack {
     static constexpr int BYTES = 4096;
@@ -34,7 +35,7 @@ static Atomic<uint32_t> howManyAreHere(0);
 bool onHypervisor = true;
 
 static constexpr uint32_t HEAP_START = 1 * 1024 * 1024;
-static constexpr uint32_t HEAP_SIZE = 5 * 1024 * 1024;
+static constexpr uint32_t HEAP_SIZE = 5 * 1024 * 1024;    // to start with, it grows from PhysMem
 static constexpr uint32_t VMM_FRAMES = HEAP_START + HEAP_SIZE;
 
 extern "C" void kernelInit(void) {
@@ -117,6 +118,9 @@ extern "C" void kernelInit(void) {
   
         /* initialize IDT */
         IDT::init();
+
+        /* mask every IOAPIC pin until a driver routes it */
+        IRQ::init();
         Pit::calibrate(1000);
 
         SMP::running.fetch_add(1);
@@ -0,0 +1,203 @@
+#include "irq.h"
+#include "idt.h"
+#include "smp.h"
+#include "atomic.h"
+#include "config.h"
+#include "debug.h"
+#include "threads.h"
+
+// the stubs in machine.S, one per vector
+extern "C" uint32_t irqStubs[];
+
+namespace IRQ {
+
+    enum IOAPIC_REGISTERS {
+        IOAPIC_VER      = 0x01,     // max redirection entry in bits 23:16
+        IOAPIC_REDTBL   = 0x10,     // two registers per pin
+
+        RED_LEVEL       = (1 << 15),
+        RED_ACTIVE_LOW  = (1 << 13),
+        RED_MASKED      = (1 << 16),
+    };
+
+    enum MSI_REGISTERS {
+        PCI_STATUS_CAPS = (1 << 20), // in the command/status dword
+        PCI_CAP_PTR     = 0x34,
+        CAP_MSI         = 0x05,
+        MSI_ENABLE      = (1 << 16), // message control is the upper half of the first dword
+        MSI_64BIT       = (1 << 23),
+        MSI_ADDRESS     = 0xFEE00000, // destination APIC id in bits 19:12
+    };
+
+    struct Route {
+        Handler handler;
+        void* arg;
+        PCI::pci_device* device;
+        uint32_t msi;       // config offset of the MSI capability, 0 if it is an IOAPIC pin
+        uint32_t pin;
+        uint32_t low;       // the pin's redirection entry without the destination
+        uint32_t cpu;
+        uint32_t count;
+    };
+
+    static Route routes[VECTORS];
+    static InterruptSafeLock lock{};
+    static uint32_t pins = 0;
+
+    static uint32_t ioapic_read(uint32_t reg) {
+        *(volatile uint32_t*) kConfig.ioAPIC = reg;
+        return *(volatile uint32_t*) (kConfig.ioAPIC + 0x10);
+    }
+
+    static void ioapic_write(uint32_t reg, uint32_t value) {
+        *(volatile uint32_t*) kConfig.ioAPIC = reg;
+        *(volatile uint32_t*) (kConfig.ioAPIC + 0x10) = value;
+    }
+
+    // the destination first, the entry is live once the low half is unmasked
+    static void write_pin(Route& r) {
+        ioapic_write(IOAPIC_REDTBL + 2 * r.pin + 1, r.cpu << 24);
+        ioapic_write(IOAPIC_REDTBL + 2 * r.pin, r.low);
+    }
+
+    static void write_msi(Route& r, uint32_t vector) {
+        PCI::pci_device* d = r.device;
+        uint32_t control = PCI::pci_config_read_dword(d, r.msi);
+        PCI::pci_config_write_dword(d, r.msi + 4, MSI_ADDRESS | (r.cpu << 12));
+        uint32_t data = r.msi + ((control & MSI_64BIT) ? 12 : 8);
+        if (control & MSI_64BIT) PCI::pci_config_write_dword(d, r.msi + 8, 0);
+        // fixed delivery, edge triggered
+        PCI::pci_config_write_dword(d, data, vector);
+        // one message, enabled
+        PCI::pci_config_write_dword(d, r.msi, (control & ~(7 << 20)) | MSI_ENABLE);
+    }
+
+    static uint32_t find_msi(PCI::pci_device* device) {
+        if ((PCI::pci_config_read_dword(device, PCI::PCI_COMMAND) & PCI_STATUS_CAPS) == 0) return 0;
+        uint32_t cap = PCI::pci_config_read_dword(device, PCI_CAP_PTR) & 0xFC;
+        // a broken list could loop, there are at most 48 capabilities in config space
+        for (int i = 0; cap != 0 && i < 48; i++) {
+            uint32_t header = PCI::pci_config_read_dword(device, cap);
+            if ((header & 0xFF) == CAP_MSI) return cap;
+            cap = (header >> 8) & 0xFC;
+        }
+        return 0;
+    }
+
+    // The IOAPIC pin an irq number is wired to. "low" comes in with the
+    // polarity and trigger mode the bus would use and goes out with what the
+    // MADT says if it has an override for the irq.
+    static uint32_t pin_of(uint32_t irq, uint32_t& low) {
+        for (uint32_t i = 0; i < kConfig.nOverrides; i++) {
+            IrqOverride& o = kConfig.overrides[i];
+            if (o.source != irq) continue;
+            uint32_t polarity = o.flags & 3;
+            uint32_t trigger = (o.flags >> 2) & 3;
+            if (polarity == 1) low &= ~RED_ACTIVE_LOW;
+            if (polarity == 3) low |= RED_ACTIVE_LOW;
+            if (trigger == 1) low &= ~RED_LEVEL;
+            if (trigger == 3) low |= RED_LEVEL;
+            return o.gsi;
+        }
+        return irq;
+    }
+
+    static int alloc_vector(Handler handler, void* arg, uint32_t cpu) {
+        LockGuard g{lock};
+        for (uint32_t i = 0; i < VECTORS; i++) {
+            if (routes[i].handler == nullptr) {
+                routes[i] = Route();
+                routes[i].handler = handler;
+                routes[i].arg = arg;
+                routes[i].cpu = cpu;
+                IDT::interrupt(FIRST_VECTOR + i, irqStubs[i]);
+                return FIRST_VECTOR + i;
+            }
+        }
+        return -1;
+    }
+
+    void init() {
+        pins = ((ioapic_read(IOAPIC_VER) >> 16) & 0xFF) + 1;
+        for (uint32_t pin = 0; pin < pins; pin++) {
+            ioapic_write(IOAPIC_REDTBL + 2 * pin, RED_MASKED);
+        }
+        Debug::printf("| irq: %d IOAPIC pins, vectors %d..%d for devices\n",
+            pins, FIRST_VECTOR, FIRST_VECTOR + VECTORS - 1);
+    }
+
+    int route_pci(PCI::pci_device* device, Handler handler, void* arg, uint32_t cpu) {
+        uint32_t msi = find_msi(device);
+        // INTx is level triggered and active low on the PCI bus
+        uint32_t low = RED_LEVEL | RED_ACTIVE_LOW;
+        uint32_t pin = pin_of(device->irq_line, low);
+        if (msi == 0 && (device->irq_line == 0 || pin >= pins)) return -1;
+
+        int vector = alloc_vector(handler, arg, cpu);
+        if (vector < 0) return -1;
+        Route& r = routes[vector - FIRST_VECTOR];
+        r.device = device;
+
+        LockGuard g{lock};
+        if (msi != 0) {
+            r.msi = msi;
+            write_msi(r, vector);
+            uint32_t command = PCI::pci_config_read_dword(device, PCI::PCI_COMMAND) & 0xFFFF;
+            PCI::pci_config_write_dword(device, PCI::PCI_COMMAND, command | PCI::PCI_COMMAND_INTX_OFF);
+        } else {
+            r.pin = pin;
+            r.low = vector | low;
+            write_pin(r);
+        }
+        Debug::printf("| irq: %x:%x on vector %d through %s, cpu %d\n", device->vendor, device->device,
+            vector, msi ? "MSI" : "the IOAPIC", cpu);
+        return vector;
+    }
+
+    int route_isa(uint32_t irq, Handler handler, void* arg, uint32_t cpu) {
+        // ISA interrupts are edge triggered and active high
+        uint32_t low = 0;
+        uint32_t pin = pin_of(irq, low);
+        if (pin >= pins) return -1;
+        int vector = alloc_vector(handler, arg, cpu);
+        if (vector < 0) return -1;
+        Route& r = routes[vector - FIRST_VECTOR];
+
+        LockGuard g{lock};
+        r.pin = pin;
+        r.low = vector | low;
+        write_pin(r);
+        return vector;
+    }
+
+    void set_affinity(int vector, uint32_t cpu) {
+        if (vector < (int) FIRST_VECTOR || vector >= (int) (FIRST_VECTOR + VECTORS)) return;
+        Route& r = routes[vector - FIRST_VECTOR];
+        LockGuard g{lock};
+        if (r.handler == nullptr) return;
+        r.cpu = cpu;
+        if (r.msi != 0) {
+            write_msi(r, vector);
+        } else {
+            write_pin(r);
+        }
+    }
+
+    uint32_t count(int vector) {
+        if (vector < (int) FIRST_VECTOR || vector >= (int) (FIRST_VECTOR + VECTORS)) return 0;
+        return routes[vector - FIRST_VECTOR].count;
+    }
+}
+
+extern "C" void irqDispatch(uint32_t vector) {
+    // interrupts are disabled.
+    IRQ::Route& r = IRQ::routes[vector - IRQ::FIRST_VECTOR];
+    r.count++;
+    if (r.handler != nullptr) r.handler(r.arg);
+    SMP::eoi();
+
+    // the handler may have woken a real-time thread, don't make it wait for a tick
+    auto me = gheith::activeThreads[SMP::me()];
+    if ((me == nullptr) || (me->isIdle) || (me->saveArea.no_preempt)) return;
+    if (gheith::rt_waiting() > me->rt) yield();
+}
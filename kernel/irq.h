@@ -0,0 +1,43 @@
+#ifndef _IRQ_H_
+#define _IRQ_H_
+
+#include "stdint.h"
+#include "pci.h"
+
+// Device interrupt routing
+//
+// Devices get a vector from FIRST_VECTOR on and their handler is called from
+// the common stub with interrupts disabled, followed by the EOI. PCI devices
+// use MSI when they have the capability, everything else goes through the
+// IOAPIC. The cpu argument is the APIC id of the core that takes the interrupt.
+//
+// reference: https://wiki.osdev.org/IOAPIC, PCI local bus spec 3.0 section 6.8
+
+namespace IRQ {
+
+    constexpr uint32_t FIRST_VECTOR = 64;
+    constexpr uint32_t VECTORS = 16;
+
+    typedef void (*Handler)(void* arg);
+
+    // Masks every IOAPIC pin, called once on the first core
+    extern void init();
+
+    // Routes a PCI device's interrupt to a free vector. INTx goes to the
+    // IOAPIC pin for the irq the firmware put in the interrupt line register,
+    // level triggered and active low unless the MADT overrides that irq.
+    // Returns the vector or -1.
+    extern int route_pci(PCI::pci_device* device, Handler handler, void* arg, uint32_t cpu = 0);
+
+    // Routes a legacy ISA irq to a free vector. Edge triggered on the same
+    // IOAPIC pin unless the MADT overrides it.
+    extern int route_isa(uint32_t irq, Handler handler, void* arg, uint32_t cpu = 0);
+
+    // Sends a routed vector's interrupts to another core
+    extern void set_affinity(int vector, uint32_t cpu);
+
+    // How many interrupts the vector has seen
+    extern uint32_t count(int vector);
+}
+
+#endif
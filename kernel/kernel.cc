@@ -6,6 +6,8 @@
 #include "libk.h"
 #include "config.h"
 #include "pci.h"
+#include "audio.h"
+#include "bench.h"
 
 Shared<Node> checkFile(const char* name, Shared<Node> node) {
     // CHECK(node != nullptr);
@@ -33,7 +35,11 @@ Shared<Node> getDir(Shared<Ext2> fs, Shared<Node> node, const char* name) {
 Shared<Ext2> fs;
 
 void kernelMain(void) {
+#ifdef KERNEL_BENCH
+    Bench::copy();
+#endif
     PCI::pci_init();
+    PCI::register_driver(&audio::hda_pci_driver);
     auto d = Shared<Ide>::make(1);
     Debug::printf("mounting drive 1\n");
     fs = Shared<Ext2>::make(d);
@@ -3,6 +3,7 @@
 
 #include <stdarg.h>
 #include "io.h"
+#include "stdint.h"
 
 class K {
 public:
@@ -12,6 +13,16 @@ public:
     static int isdigit(int c);
     static bool streq(const char* left, const char* right);
 
+    // 64/32 bit division without libgcc, saturates when the quotient doesn't fit
+    static uint32_t div64(uint64_t n, uint32_t d) {
+        uint32_t hi = (uint32_t)(n >> 32);
+        uint32_t lo = (uint32_t) n;
+        if (hi >= d) return 0xffffffff;
+        uint32_t q, r;
+        asm ("divl %4" : "=a"(q), "=d"(r) : "a"(lo), "d"(hi), "rm"(d));
+        return q;
+    }
+
     template <typename T>
     static T min(T v) {
         return v;
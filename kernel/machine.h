@@ -18,6 +18,7 @@ extern "C" void invlpg(uint32_t va);
 
 extern "C" void apitHandler_(void);
 extern "C" void spuriousHandler_(void);
+extern "C" void reschedHandler_(void);
 extern "C" void pageFaultHandler_(void);
 
 extern "C" void* memcpy(void *dest, const void* src, size_t n);
@@ -29,6 +30,7 @@ extern "C" uint32_t getCR3();
 extern "C" uint32_t getFlags();
 extern "C" void monitor(uintptr_t);
 extern "C" void mwait();
+extern "C" uint64_t rdtsc();
 
 struct cpuid_out {
     uint32_t a;
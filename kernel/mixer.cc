@@ -0,0 +1,254 @@
+#include "mixer.h"
+#include "resample.h"
+#include "debug.h"
+#include "libk.h"
+
+using namespace audio;
+
+template <typename T, typename Wide>
+static void saturate(T* dst, const T* src, uint32_t samples, Wide lo, Wide hi) {
+    for (uint32_t i = 0; i < samples; i++) {
+        Wide sum = (Wide) dst[i] + (Wide) src[i];
+        if (sum > hi) sum = hi;
+        else if (sum < lo) sum = lo;
+        dst[i] = (T) sum;
+    }
+}
+
+void audio::mix_saturate(int8_t* dst, const int8_t* src, uint32_t samples) {
+    saturate<int8_t, int32_t>(dst, src, samples, -128, 127);
+}
+
+void audio::mix_saturate(int16_t* dst, const int16_t* src, uint32_t samples) {
+    saturate<int16_t, int32_t>(dst, src, samples, -32768, 32767);
+}
+
+// 20 and 24 bit samples sit in the top of their container so this clamps them too
+void audio::mix_saturate(int32_t* dst, const int32_t* src, uint32_t samples) {
+    saturate<int32_t, int64_t>(dst, src, samples, -2147483647LL - 1, 2147483647LL);
+}
+
+/////////////////
+// RingSource //
+////////////////
+
+uint32_t RingSource::write(const char* buffer, uint32_t n) {
+    uint32_t done = 0;
+    while (done < n) {
+        uint32_t k = ring.write(buffer + done, n - done);
+        if (k != 0) {
+            started = true;
+            done += k;
+            continue;
+        }
+        // full, wait for the refill thread to drain a period. It might have
+        // done that between our write and setting the flag so check again.
+        writer_waiting.set(true);
+        if (ring.writable() == 0) {
+            space.down();
+        }
+    }
+    return done;
+}
+
+uint32_t RingSource::fill(char* buffer, uint32_t bytes) {
+    // look at closed first, everything written before the close is in the ring
+    bool last = closed.get();
+    uint32_t n = ring.read(buffer, bytes);
+    if (writer_waiting.exchange(false)) {
+        space.up();
+    }
+    if (n == bytes || last) return n;
+
+    // the writer fell behind, keep the stream alive with silence
+    if (started) underruns++;
+    bzero(buffer + n, bytes - n);
+    return bytes;
+}
+
+///////////
+// Mixer //
+///////////
+
+static void free_stream(audio_stream* stream, bool with_source) {
+    if (stream->input != stream->source) delete stream->input;
+    if (with_source) delete stream->source;
+    delete stream->played;
+    delete stream;
+}
+
+Mixer::Mixer(hda_audio_device* hda) : hda(hda), scratch(new char[BUFFER_SIZE]),
+    lock(), open_lock(), handles(), fills(0), active(0), rate(0), channels(0), format(AUDIO_16SI), exclusive(false) {}
+
+bool Mixer::reserve(bool on) {
+    LockGuard g{open_lock};
+    if (on) {
+        LockGuard g2{lock};
+        if (active != 0) return false;
+    }
+    exclusive = on;
+    return true;
+}
+
+int Mixer::open(audio_source* source, uint32_t rate, uint32_t channels, audio_sample_format format) {
+    LockGuard g{open_lock};
+    if (exclusive) return -1;
+    audio_stream** streams = hda->audio->streams;
+
+    uint32_t playing;
+    {
+        LockGuard g2{lock};
+        playing = active;
+    }
+
+    // the codec plays one format at a time, the first stream picks it. The
+    // engine may still be playing out the silence after the last stream, it
+    // can't keep running while the converter changes under it. Holding
+    // open_lock keeps anybody else from starting it again.
+    if (playing == 0) {
+        audio_stop(hda);
+        int picked = audio_set_sample_format(hda->audio, format);
+        if (picked < 0) return -1;
+        this->format = (audio_sample_format) picked;
+        this->channels = audio_set_chnl_ct(hda->audio, channels);
+        this->rate = audio_set_sample_rate(hda->output->stream, rate);
+    }
+    // only the sample rate gets converted
+    if (channels != this->channels || audio_sample_bytes(format) != audio_sample_bytes(this->format)) {
+        return -1;
+    }
+
+    // convert anything the codec isn't running at
+    audio_source* input = source;
+    if (rate != this->rate) {
+        if (format != AUDIO_16SI) return -1;
+        input = Resampler::open(source, rate, this->rate, channels);
+        if (input == nullptr) return -1;
+    }
+
+    // no heap calls while holding the interrupt safe lock
+    audio_stream* stream = new audio_stream();
+    stream->device = hda->audio;
+    stream->num_buffers = BDL_SIZE;
+    stream->buffer_size = BUFFER_SIZE / audio_sample_bytes(format);
+    stream->sample_format = format;
+    stream->source = source;
+    stream->input = input;
+    stream->played = new Semaphore(0);
+    stream->finished_at = 0;
+    stream->detached = false;
+
+    int id = -1;
+    {
+        LockGuard g2{lock};
+        for (uint32_t i = 0; i < MAX_STREAMS; i++) {
+            if (streams[i] == nullptr && handles[i] == nullptr) {
+                streams[i] = stream;
+                handles[i] = stream;
+                active++;
+                id = i;
+                break;
+            }
+        }
+    }
+    if (id < 0) {
+        free_stream(stream, false);
+        return -1;
+    }
+
+    audio_start(hda);
+    return id;
+}
+
+void Mixer::wait(int id) {
+    audio_stream* stream = handles[id];
+    stream->played->down();
+    {
+        LockGuard g{lock};
+        handles[id] = nullptr;
+    }
+    free_stream(stream, false);
+}
+
+void Mixer::detach(int id) {
+    audio_stream* stream;
+    bool playing;
+    {
+        LockGuard g{lock};
+        stream = handles[id];
+        handles[id] = nullptr;
+        playing = (hda->audio->streams[id] == stream);
+        if (playing) stream->detached = true;
+    }
+    if (!playing) {
+        // already played out, nobody else will free it
+        free_stream(stream, true);
+    }
+}
+
+// The last sample of the stream has been played
+void Mixer::retire(audio_stream* stream) {
+    if (stream->detached) {
+        free_stream(stream, true);
+    } else {
+        stream->played->up();
+    }
+}
+
+uint32_t Mixer::fill(char* buffer, uint32_t bytes) {
+    audio_stream** streams = hda->audio->streams;
+    audio_stream* playing[MAX_STREAMS];
+    audio_stream* done[MAX_STREAMS];
+    uint32_t nplaying = 0;
+    uint32_t ndone = 0;
+    uint32_t fill_number;
+
+    {
+        LockGuard g{lock};
+        // 0 means "still playing" in finished_at
+        if (++fills == 0) fills = 1;
+        fill_number = fills;
+        for (uint32_t i = 0; i < MAX_STREAMS; i++) {
+            audio_stream* stream = streams[i];
+            if (stream == nullptr) continue;
+            if (stream->finished_at == 0) {
+                playing[nplaying++] = stream;
+            } else if (fill_number - stream->finished_at + 1 >= BDL_SIZE) {
+                // the slot with its last samples finished playing just now
+                streams[i] = nullptr;
+                active--;
+                done[ndone++] = stream;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < ndone; i++) {
+        retire(done[i]);
+    }
+
+    uint32_t produced = 0;
+    for (uint32_t i = 0; i < nplaying; i++) {
+        audio_stream* stream = playing[i];
+        if (produced == 0) {
+            // straight into the DMA buffer
+            produced = stream->input->fill(buffer, bytes);
+            if (produced == 0) stream->finished_at = fill_number;
+            continue;
+        }
+        uint32_t n = stream->input->fill(scratch, bytes);
+        if (n == 0) {
+            stream->finished_at = fill_number;
+            continue;
+        }
+        if (n > produced) {
+            bzero(buffer + produced, n - produced);
+            produced = n;
+        }
+        switch (audio_sample_bytes(format)) {
+            case 1: mix_saturate((int8_t*) buffer, (int8_t*) scratch, n); break;
+            case 2: mix_saturate((int16_t*) buffer, (int16_t*) scratch, n / 2); break;
+            default: mix_saturate((int32_t*) buffer, (int32_t*) scratch, n / 4); break;
+        }
+    }
+    return produced;
+}
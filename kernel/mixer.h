@@ -0,0 +1,98 @@
+#ifndef _mixer_h_
+#define _mixer_h_
+
+#include "stdint.h"
+#include "atomic.h"
+#include "semaphore.h"
+#include "blocking_lock.h"
+#include "ring.h"
+#include "audio.h"
+
+namespace audio {
+
+    constexpr uint32_t MAX_STREAMS = 8;
+
+    // A stream fed by a user process through audio_write. The process is the
+    // producer and the refill thread the consumer so the ring needs no lock.
+    class RingSource : public audio_source {
+        SpscRing ring;
+        Atomic<bool> closed;
+        Atomic<bool> writer_waiting;
+        Semaphore space;           // upped by the consumer when a writer waits for room
+        bool started;              // the first write made it to the ring
+    public:
+        int id;                    // mixer stream id
+        uint32_t underruns;        // periods that found the ring short
+        uint32_t frame_bytes;      // of the process's format
+
+        RingSource(uint32_t size) : ring(size), closed(false), writer_waiting(false), space(0), started(false), id(-1), underruns(0), frame_bytes(4) {}
+
+        // producer: blocks until all n bytes are in the ring
+        uint32_t write(const char* buffer, uint32_t n);
+
+        // bytes written but not mixed yet
+        uint32_t buffered() {
+            return ring.readable();
+        }
+
+        // producer: no more data, the stream ends once the ring drains
+        void close() {
+            closed.set(true);
+        }
+
+        uint32_t fill(char* buffer, uint32_t bytes) override;
+    };
+
+    // Sums up to MAX_STREAMS streams into the engine's BDL buffers. It is the
+    // source of the streaming engine; the refill thread calls fill once per period.
+    //
+    //    - the first stream fills the DMA buffer directly (no copy for a single stream)
+    //    - every other stream fills a scratch period which is then added with
+    //      saturation in the codec's sample size, one whole period per pass
+    //
+    class Mixer : public audio_source {
+        hda_audio_device* hda;
+        char* scratch;              // one period
+        InterruptSafeLock lock;     // guards the stream table
+        BlockingLock open_lock;     // serializes open (it can reconfigure the codec)
+        audio_stream* handles[MAX_STREAMS]; // streams nobody has waited for or detached yet
+        uint32_t fills;             // how many periods we produced
+        uint32_t active;            // streams in the table
+        uint32_t rate;              // what the codec runs at, other rates get resampled
+        uint32_t channels;          // every stream in the table has this many
+        audio_sample_format format; // and samples of this size
+        bool exclusive;             // a process mapped the DMA buffers, nothing else plays
+
+        void retire(audio_stream* stream);
+    public:
+        Mixer(hda_audio_device* hda);
+
+        // Adds a stream playing "source" at the given format and starts the engine
+        // if needed. The first stream picks the codec's format, 16 bit streams at
+        // other rates go through a Resampler. Returns the stream id or -1 if the
+        // table is full, the channel count or sample size doesn't match the other
+        // streams or the rate can't be converted.
+        int open(audio_source* source, uint32_t rate, uint32_t channels, audio_sample_format format);
+
+        // Keeps every other stream out while a process owns the DMA buffers.
+        // Fails if a stream is still in the table.
+        bool reserve(bool on);
+
+        // Blocks until the last sample of the stream has been played, then frees
+        // it. The caller still owns the source.
+        void wait(int id);
+
+        // Nobody will wait: the mixer frees the stream and deletes the source
+        // once it has played out
+        void detach(int id);
+
+        uint32_t fill(char* buffer, uint32_t bytes) override;
+    };
+
+    // adds src into dst, clamping to the range of the sample type
+    extern void mix_saturate(int8_t* dst, const int8_t* src, uint32_t samples);
+    extern void mix_saturate(int16_t* dst, const int16_t* src, uint32_t samples);
+    extern void mix_saturate(int32_t* dst, const int32_t* src, uint32_t samples);
+}
+
+#endif
@@ -11,11 +11,13 @@ namespace PCI {
     uint32_t drivers;
 
     void add_device(pci_device* device) {
+        if (devices == 32) return;
         pci_devices[devices] = device;
         devices++;
     }
 
     void add_driver(pci_driver* driver) {
+        if (drivers == 32) return;
         pci_drivers[drivers] = driver;
         drivers++;
     }
@@ -39,6 +41,22 @@ namespace PCI {
         return tmp;
     }
 
+    uint32_t pci_config_read_dword(pci_device* device, uint8_t offset) {
+        outl(0xCF8, (device->bus << 16) | (device->slot << 11) | (device->func << 8) | (offset & 0xFC) | 0x80000000);
+        return inl(0xCFC);
+    }
+
+    void pci_config_write_dword(pci_device* device, uint8_t offset, uint32_t value) {
+        outl(0xCF8, (device->bus << 16) | (device->slot << 11) | (device->func << 8) | (offset & 0xFC) | 0x80000000);
+        outl(0xCFC, value);
+    }
+
+    void pci_enable(pci_device* device) {
+        // the status half is write one to clear, leave it alone
+        uint32_t command = pci_config_read_dword(device, PCI_COMMAND) & 0xFFFF;
+        pci_config_write_dword(device, PCI_COMMAND, command | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+    }
+
     inline uint16_t get_vendor_id(uint16_t bus, uint16_t slot, uint16_t func) {
         return pci_config_read_word(bus, slot, func, 0);
     }
@@ -64,6 +82,10 @@ namespace PCI {
                     device->device = device_id;
                     device->func = func;
                     device->driver = nullptr;
+                    device->bus = bus;
+                    device->slot = slot;
+                    device->class_id = pci_config_read_dword(device, PCI_CLASS) >> 16;
+                    device->irq_line = pci_config_read_dword(device, PCI_INTERRUPT_LINE) & 0xFF;
                     add_device(device);
                 }
             }
@@ -76,7 +98,7 @@ namespace PCI {
             if (device->driver) {
                 // shouldn't need to do anyhting in here for now
             } else {
-                Debug::printf("PCI DUMP: vendor: %x, device: %x, function: %x\n", device->vendor, device->device, device->func);
+                Debug::printf("PCI DUMP: vendor: %x, device: %x, function: %x, class: %x\n", device->vendor, device->device, device->func, device->class_id);
             }
         }
     }
@@ -90,4 +112,25 @@ namespace PCI {
         // Debug::printf("PCI Initialized.\n");
         pci_debug();
     }
-}
\ No newline at end of file
+
+    static bool matches(pci_driver* driver, pci_device* device) {
+        if (driver->class_id != 0 && driver->class_id == device->class_id) return true;
+        if (driver->device_id_table == nullptr) return false;
+        for (device_id* id = driver->device_id_table; id->vendor_id != 0; id++) {
+            if (id->vendor_id == device->vendor && id->device_id == device->device) return true;
+        }
+        return false;
+    }
+
+    void register_driver(pci_driver* driver) {
+        add_driver(driver);
+        if (driver->init_driver != nullptr) driver->init_driver();
+        for (uint32_t i = 0; i < devices; i++) {
+            pci_device* device = pci_devices[i];
+            if (device->driver == nullptr && matches(driver, device) && driver->init_device(device) == 0) {
+                device->driver = driver;
+                Debug::printf("| pci: %s bound to %x:%x\n", driver->name, device->vendor, device->device);
+            }
+        }
+    }
+}
@@ -20,6 +20,10 @@ namespace PCI {
         uint32_t device;
         uint32_t func; 
         struct pci_driver* driver;
+        uint32_t bus;
+        uint32_t slot;
+        uint32_t class_id;  // class << 8 | subclass
+        uint8_t irq_line;   // what the firmware routed INTx to on the legacy PICs
     } pci_device;
 
     typedef struct device_id {
@@ -31,13 +35,35 @@ namespace PCI {
     typedef struct pci_driver {
         device_id* device_id_table;
         char* name;
-        uint8_t (*init_device)(pci_device*);
+        uint8_t (*init_device)(pci_device*); // 0 if it took the device
         uint8_t (*init_driver)(void);   
         uint8_t (*exit_driver)(void);
+        uint32_t class_id;  // class << 8 | subclass to take any vendor's device, 0 for none
     } pci_driver;
 
+    enum PCI_CONFIG {
+        PCI_COMMAND         = 0x04,
+        PCI_CLASS           = 0x08,     // revision, prog if, subclass, class
+        PCI_BAR0            = 0x10,
+        PCI_INTERRUPT_LINE  = 0x3c,
+
+        PCI_COMMAND_MEMORY  = (1 << 1),
+        PCI_COMMAND_MASTER  = (1 << 2), // the device may DMA
+        PCI_COMMAND_INTX_OFF = (1 << 10),
+    };
+
+    extern uint32_t pci_config_read_dword(pci_device* device, uint8_t offset);
+    extern void pci_config_write_dword(pci_device* device, uint8_t offset, uint32_t value);
+
+    // Turns on memory decoding and bus mastering
+    extern void pci_enable(pci_device* device);
+
     extern void pci_init();
 
+    // Adds the driver and gives it every device it matches that has no driver
+    // yet, by class or through its id table (ends with a 0 vendor id)
+    extern void register_driver(pci_driver* driver);
+
     extern void pci_debug();
 
 }
@@ -5,49 +5,153 @@
 #include "atomic.h"
 #include "idt.h"
 
+// A buddy allocator. A block of order k is 2^k frames and starts on a
+// 2^k frame boundary. Freeing a block merges it with its buddy for as
+// long as the buddy is free too.
+
 namespace PhysMem {
 
     static InterruptSafeLock lock{};
 
-    struct Frame {
-        Frame* next;
+    struct Block {
+        Block* next;
+        Block* prev;
     };
 
-    static Frame* firstFree = nullptr;
-    static uint32_t avail;
-    static uint32_t limit;
+    static Block* free_lists[MAX_ORDER + 1];
 
-    uint32_t alloc_frame() {
-        LockGuard g{lock};
+    // one byte per frame, FREE | order on the first frame of a free block
+    // and 0 everywhere else
+    constexpr uint8_t FREE = 0x80;
+    static uint8_t* state = nullptr;
 
-        uint32_t p;
+    static uint32_t first;      // first frame number we manage
+    static uint32_t last;       // one past the last
 
-        if (firstFree != nullptr) {
-            p = (uint32_t) firstFree;
-            firstFree = firstFree->next;
+    static void push(uint32_t pfn, uint32_t order) {
+        Block* b = (Block*) (pfn * FRAME_SIZE);
+        b->prev = nullptr;
+        b->next = free_lists[order];
+        if (b->next != nullptr) b->next->prev = b;
+        free_lists[order] = b;
+        state[pfn - first] = FREE | order;
+    }
+
+    static void unlink(uint32_t pfn, uint32_t order) {
+        Block* b = (Block*) (pfn * FRAME_SIZE);
+        if (b->prev != nullptr) {
+            b->prev->next = b->next;
         } else {
-            if (avail == limit) {
-                Debug::panic("no more frames");
-            }
-            p = avail;
-            avail += FRAME_SIZE;
+            free_lists[order] = b->next;
         }
+        if (b->next != nullptr) b->next->prev = b->prev;
+        state[pfn - first] = 0;
+    }
 
-        ASSERT(offset(p) == 0);
+    // called with the lock held
+    static uint32_t take(uint32_t order) {
+        uint32_t k = order;
+        while (k <= MAX_ORDER && free_lists[k] == nullptr) k++;
+        if (k > MAX_ORDER) return 0;
+
+        uint32_t pfn = ((uint32_t) free_lists[k]) / FRAME_SIZE;
+        unlink(pfn, k);
 
-        bzero((void*)p,FRAME_SIZE);
+        // give back the upper halves we don't need
+        while (k > order) {
+            k--;
+            push(pfn + (1 << k), k);
+        }
+
+        return pfn * FRAME_SIZE;
+    }
 
+    // called with the lock held
+    static void give(uint32_t pfn, uint32_t order) {
+        while (order < MAX_ORDER) {
+            uint32_t buddy = pfn ^ (1 << order);
+            if (buddy < first || buddy + (1 << order) > last) break;
+            if (state[buddy - first] != (FREE | order)) break;
+            unlink(buddy, order);
+            if (buddy < pfn) pfn = buddy;
+            order++;
+        }
+        push(pfn, order);
+    }
+
+    // free frames [pfn, end) as the biggest aligned blocks that fit
+    static void give_range(uint32_t pfn, uint32_t end) {
+        while (pfn < end) {
+            uint32_t order = MAX_ORDER;
+            while ((pfn & ((1 << order) - 1)) != 0 || pfn + (1 << order) > end) order--;
+            give(pfn, order);
+            pfn += 1 << order;
+        }
+    }
+
+    static uint32_t order_for(uint32_t n) {
+        uint32_t order = 0;
+        while ((1u << order) < n) order++;
+        return order;
+    }
+
+    bool ready() {
+        return state != nullptr;
+    }
+
+    uint32_t alloc_block(uint32_t order) {
+        ASSERT(order <= MAX_ORDER);
+        uint32_t p;
+        {
+            LockGuard g{lock};
+            p = take(order);
+        }
+        if (p != 0) bzero((void*)p,FRAME_SIZE << order);
         return p;
     }
 
-    void dealloc_frame(uint32_t p) {
+    void dealloc_block(uint32_t p, uint32_t order) {
         LockGuard g{lock};
 
         ASSERT(offset(p) == 0);
+        ASSERT((ppn(p) & ((1 << order) - 1)) == 0);
+        ASSERT(state[ppn(p) - first] == 0);
+
+        give(ppn(p), order);
+    }
+
+    uint32_t alloc_frame() {
+        uint32_t p = alloc_block(0);
+        if (p == 0) {
+            Debug::panic("no more frames");
+        }
+        return p;
+    }
+
+    uint32_t alloc_frames(uint32_t n) {
+        uint32_t order = order_for(n);
+        if (order > MAX_ORDER) {
+            Debug::panic("no room for %d contiguous frames",n);
+        }
+
+        uint32_t p;
+        {
+            LockGuard g{lock};
+            p = take(order);
+            if (p == 0) {
+                Debug::panic("no room for %d contiguous frames",n);
+            }
+            // the block is rounded up to a power of 2, keep only n frames
+            give_range(ppn(p) + n, ppn(p) + (1 << order));
+        }
+
+        bzero((void*)p,n * FRAME_SIZE);
+
+        return p;
+    }
 
-        Frame* f = (Frame*) p;    
-        f->next = firstFree;
-        firstFree = f;
+    void dealloc_frame(uint32_t p) {
+        dealloc_block(p, 0);
     }
 
 
@@ -55,12 +159,20 @@ namespace PhysMem {
         ASSERT(offset(start) == 0);
         ASSERT(offset(size) == 0);
         Debug::printf("| physical range 0x%x 0x%x\n",start,start+size);
-        avail = start;
-        limit = start + size;
+
+        // the per frame state lives at the bottom of the range
+        uint32_t frames = size / FRAME_SIZE;
+        uint8_t* bytes = (uint8_t*) start;
+        bzero(bytes,frames);
+
+        first = ppn(start + frameup(frames));
+        last = ppn(start + size);
+        state = bytes;
+
+        give_range(first, last);
 
         /* register the page fault handler */
         IDT::trap(14,(uint32_t)pageFaultHandler_,3);
     }
-    
-};
 
+};
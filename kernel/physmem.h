@@ -5,9 +5,15 @@
 
 namespace PhysMem {
     constexpr uint32_t FRAME_SIZE = 1 << 12;
+    // 2GB blocks, as big as anything we could have contiguous below 4GB.
+    // Blocks only get that big if there is that much memory.
+    constexpr uint32_t MAX_ORDER = 19;
 
     void init(uint32_t start, uint32_t size);
 
+    // false until init has been called
+    bool ready();
+
     inline uint32_t offset(uint32_t pa) {
         return pa & 0xFFF;
     }
@@ -24,8 +30,19 @@ namespace PhysMem {
         return framedown(pa + FRAME_SIZE - 1);
     }
 
+    // 2^order contiguous frames aligned to their size, 0 if there are none
+    uint32_t alloc_block(uint32_t order);
+
+    void dealloc_block(uint32_t pa, uint32_t order);
+
     uint32_t alloc_frame();
 
+    // allocate n physically contiguous frames (for DMA buffers), starting
+    // on a boundary of the next power of 2. The frames past n are freed
+    // right away, so only a power of 2 can go back in one dealloc_block,
+    // anything else goes back a frame at a time with dealloc_frame.
+    uint32_t alloc_frames(uint32_t n);
+
     void dealloc_frame(uint32_t);
 }
 
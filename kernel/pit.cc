@@ -4,6 +4,7 @@
 #include "idt.h"
 #include "smp.h"
 #include "threads.h"
+#include "timer.h"
 
 /*
  * The old PIT runs at a fixed frequency of 1193182Hz but doesn't support
@@ -31,6 +32,24 @@ constexpr uint32_t APIT_vector = 40;
 uint32_t Pit::jiffiesPerSecond = 0;
 uint32_t Pit::apitCounter = 0;
 uint32_t Pit::jiffies = 0;
+uint64_t Pit::tscPerSecond = 0;
+uint32_t Pit::tscPerMicro = 0;
+
+// The APIT runs one-shot (or in TSC-deadline mode when the CPU has it) and
+// each core programs it for whichever comes first, its next tick or its
+// nearest high resolution timer
+constexpr uint32_t IA32_TSC_DEADLINE = 0x6E0;
+constexpr uint32_t LVT_TSC_DEADLINE = 2 << 17;
+
+static uint32_t tscPerJiffy = 0;
+static bool tscDeadline = false;
+
+struct CoreTimer {
+    uint64_t next_tick;
+    bool ticking;
+};
+
+static PerCPU<CoreTimer> coreTimers;
 
 struct PitInfo {
 };
@@ -73,6 +92,7 @@ void Pit::calibrate(uint32_t hz) {
 
     uint32_t initial = 0xffffffff;
     SMP::apit_initial_count.set(initial);
+    uint64_t tscStart = rdtsc();
 
     outb(0x61,1);          // speaker off, gate on
 
@@ -102,6 +122,10 @@ void Pit::calibrate(uint32_t hz) {
     }
     
     uint32_t diff = initial - SMP::apit_current_count.get();
+    // the same second also tells us how fast the TSC runs
+    tscPerSecond = rdtsc() - tscStart;
+    tscPerMicro = K::div64(tscPerSecond, 1000000);
+    tscPerJiffy = K::div64(tscPerSecond, hz);
 
     // stop the PIT
     outb(0x61,0);
@@ -110,11 +134,54 @@ void Pit::calibrate(uint32_t hz) {
     apitCounter = diff / hz;
     jiffiesPerSecond = hz;
     Debug::printf("| APIT counter=%d for %dHz\n",apitCounter,hz);
+    Debug::printf("| TSC running at %uKHz\n",K::div64(tscPerSecond,1000));
+
+    cpuid_out out;
+    cpuid(1,&out);
+    tscDeadline = (out.c & (1 << 24)) != 0;
+    Debug::printf("| APIT %s\n", tscDeadline ? "uses TSC deadlines" : "runs one-shot");
 
     // Register the APIT interrupt handler
     IDT::interrupt(APIT_vector, (uint32_t)apitHandler_);
 }
 
+// program this core's timer for the given rdtsc() value, interrupts disabled
+void Pit::arm(uint64_t deadline) {
+    if (deadline == ~uint64_t(0)) {
+        // nothing to wait for
+        if (tscDeadline) {
+            wrmsr(IA32_TSC_DEADLINE, 0);
+        } else {
+            SMP::apit_initial_count.set(0);
+        }
+        return;
+    }
+
+    if (tscDeadline) {
+        wrmsr(IA32_TSC_DEADLINE, deadline);
+        return;
+    }
+
+    // convert to APIT counts, apitCounter of them make a jiffy
+    uint64_t now = rdtsc();
+    uint32_t count = 1;
+    if (deadline > now) {
+        count = K::div64((deadline - now) * apitCounter, tscPerJiffy);
+        if (count == 0) count = 1;
+    }
+    SMP::apit_initial_count.set(count);
+}
+
+void Pit::reprogram() {
+    Interrupts::protect([] {
+        auto id = SMP::me();
+        auto& c = coreTimers.forCPU(id);
+        uint64_t next = HrTimers::next(id);
+        if (c.ticking && c.next_tick < next) next = c.next_tick;
+        arm(next);
+    });
+}
+
 // Called by each CPU in order to initialize its own PIT
 void Pit::init() {
     if (apitCounter == 0) {
@@ -126,23 +193,60 @@ void Pit::init() {
     // The following line will enable timer interrupts for this CPU
     // You better be prepared for it
     SMP::apit_lvt_timer.set(
-        (1 << 17) |      // Timer mode: 1 -> Periodic
+        (tscDeadline ? LVT_TSC_DEADLINE : 0) |  // Timer mode: one-shot or TSC deadline
         0 << 16   |      // mask: 0 -> interrupts not masked
         APIT_vector      // the interrupt vector
     );
-        
+
     // Let's go
-    SMP::apit_initial_count.set(apitCounter);
+    startTicks();
+}
+
+void Pit::stopTicks() {
+    Interrupts::protect([] {
+        coreTimers.mine().ticking = false;
+        reprogram();
+    });
+}
+
+void Pit::startTicks() {
+    Interrupts::protect([] {
+        auto& c = coreTimers.mine();
+        c.ticking = true;
+        c.next_tick = rdtsc() + tscPerJiffy;
+        reprogram();
+    });
 }
 
 extern "C" void apitHandler(uint32_t* things) {
     // interrupts are disabled.
     auto id = SMP::me();
-    if (id == 0) {
-        Pit::jiffies ++;
-    }
     SMP::eoi_reg.set(0);
+
+    uint64_t now = rdtsc();
+    auto& c = coreTimers.forCPU(id);
+    bool tick = c.ticking && now >= c.next_tick;
+    if (tick) {
+        // a late tick doesn't turn into a burst of them
+        c.next_tick += tscPerJiffy;
+        if (c.next_tick <= now) c.next_tick = now + tscPerJiffy;
+        if (id == 0) {
+            Pit::jiffies ++;
+            // timers can wake threads, do it before we decide whether to yield
+            TimerWheel::tick();
+        }
+    }
+    HrTimers::expire(id, now);
+    Pit::reprogram();
+
     auto me = gheith::activeThreads[id];
     if ((me == nullptr) || (me->isIdle) || (me->saveArea.no_preempt)) return;
+    if (!tick) {
+        // only a high resolution timer, preempt if it woke someone more important
+        if (gheith::rt_waiting() > me->rt) yield();
+        return;
+    }
+    // real-time threads only take turns with their own level or above
+    if (me->rt != 0 && gheith::rt_waiting() < me->rt) return;
     yield();
 }
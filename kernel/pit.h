@@ -5,23 +5,42 @@
 #include "smp.h"
 #include "atomic.h"
 #include "debug.h"
+#include "libk.h"
 
 class Thread;
 
 class Pit {
     static uint32_t jiffiesPerSecond;
     static uint32_t apitCounter;
+    static void arm(uint64_t deadline);
 public:
     static uint32_t jiffies;
+    static uint64_t tscPerSecond;
+    static uint32_t tscPerMicro;
     static void calibrate(uint32_t hz);
     static void init();
+    // stop and restart this core's tick, for idle cores
+    static void stopTicks();
+    static void startTicks();
+    // point this core's timer at its next tick or high resolution
+    // timer, whichever comes first
+    static void reprogram();
     static uint32_t secondsToJiffies(uint32_t secs) {
         return jiffiesPerSecond * secs;
     }
+    // rounds up, a wait is never shorter than asked for
+    static uint32_t millisToJiffies(uint32_t ms) {
+        return K::div64((uint64_t) ms * jiffiesPerSecond + 999, 1000);
+    }
     static uint32_t seconds(void) {
         return jiffies / jiffiesPerSecond;
         return 0;
     }
+    // convert a TSC delta (as returned by rdtsc) into microseconds
+    static uint32_t tscToMicros(uint64_t cycles) {
+        if (tscPerMicro == 0) return 0;
+        return K::div64(cycles, tscPerMicro);
+    }
 
 };
 
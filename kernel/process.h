@@ -4,6 +4,9 @@
 #include "ext2.h"
 #include "atomic.h"
 #include "future.h"
+#include "slab.h"
+
+namespace audio { class RingSource; }
 
 struct FileDescriptor{
     Shared<Node> file;
@@ -11,6 +14,9 @@ struct FileDescriptor{
     bool reserved;
     Atomic<int> ref_count;
     FileDescriptor() : file(nullptr), offset(0), reserved(false), ref_count(0) {}
+
+    static void* operator new(size_t size) { return Slab::fds.alloc(size); }
+    static void operator delete(void* p, size_t size) { Slab::fds.free(p, size); }
 };
 
 struct PCB {
@@ -20,6 +26,8 @@ struct PCB {
     Shared<Semaphore> sp[10];
     // 20 to 29
     Shared<Future<int>> cp[10];
+    // 30 to 39, not inherited by fork
+    audio::RingSource* as[10];
 
     Shared<Future<int>> future;
 
@@ -28,6 +36,7 @@ struct PCB {
             fd[i] = nullptr;
             cp[i] = nullptr;
             sp[i] = nullptr;
+            as[i] = nullptr;
         }
         fd[0] = new FileDescriptor();
         fd[1] = new FileDescriptor();
@@ -37,6 +46,9 @@ struct PCB {
         fd[2]->reserved = true;
         future = Shared<Future<int>>::make();
     }
+
+    static void* operator new(size_t size) { return Slab::pcbs.alloc(size); }
+    static void operator delete(void* p, size_t size) { Slab::pcbs.free(p, size); }
 };
 
 #endif
\ No newline at end of file
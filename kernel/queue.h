@@ -20,6 +20,11 @@ public:
         monitor((uintptr_t)&first);
     }
 
+    // no lock, a hint that can be stale by the time it returns
+    bool empty() {
+        return first == nullptr;
+    }
+
     void add(T* t) {
         LockGuard g{lock};
         t->next = nullptr;
@@ -44,6 +49,25 @@ public:
         return it;
     }
 
+    // take t out wherever it is, false if it isn't here
+    bool remove(T* t) {
+        LockGuard g{lock};
+        T* prev = nullptr;
+        for (T* it = first; it != nullptr; it = it->next) {
+            if (it == t) {
+                if (prev == nullptr) {
+                    first = it->next;
+                } else {
+                    prev->next = it->next;
+                }
+                if (last == it) last = prev;
+                return true;
+            }
+            prev = it;
+        }
+        return false;
+    }
+
     T* remove_all() {
         LockGuard g{lock};
         auto it = first;
@@ -0,0 +1,226 @@
+#include "resample.h"
+#include "debug.h"
+#include "libk.h"
+#include "machine.h"
+#include "pit.h"
+
+using namespace audio;
+
+constexpr int32_t ONE_Q30 = 1 << 30;
+constexpr int64_t HALF_PI_Q30 = 1686629713;  // pi/2 * 2^30
+constexpr uint32_t PI_Q16 = 205887;          // pi * 2^16
+
+// 1/k in Q30 for the Taylor series below
+constexpr int64_t INV_6 = 178956971;
+constexpr int64_t INV_20 = 53687091;
+constexpr int64_t INV_42 = 25565282;
+constexpr int64_t INV_72 = 14913081;
+constexpr int64_t INV_110 = 9761289;
+
+// num/den of a full turn as a 0.32 fraction
+static uint32_t turns(int32_t num, uint32_t den) {
+    int32_t r = num % (int32_t) den;
+    if (r < 0) r += den;
+    return K::div64((uint64_t) r << 32, den);
+}
+
+// sin(2*pi*t) for t in turns (0.32), result in Q30. Folded into the first
+// quadrant and then a Taylor series up to x^11, good to about 1e-7 there.
+static int32_t sin_turns(uint32_t t) {
+    uint32_t quadrant = t >> 30;
+    int64_t f = t & 0x3fffffff;
+    if (quadrant & 1) f = ONE_Q30 - f;
+    int64_t x = (f * HALF_PI_Q30) >> 30;
+    int64_t x2 = (x * x) >> 30;
+
+    // x(1 - x^2/6(1 - x^2/20(1 - x^2/42(1 - x^2/72(1 - x^2/110)))))
+    int64_t s = ONE_Q30;
+    s = ONE_Q30 - ((((x2 * s) >> 30) * INV_110) >> 30);
+    s = ONE_Q30 - ((((x2 * s) >> 30) * INV_72) >> 30);
+    s = ONE_Q30 - ((((x2 * s) >> 30) * INV_42) >> 30);
+    s = ONE_Q30 - ((((x2 * s) >> 30) * INV_20) >> 30);
+    s = ONE_Q30 - ((((x2 * s) >> 30) * INV_6) >> 30);
+    int32_t r = (int32_t) ((x * s) >> 30);
+    return (quadrant & 2) ? -r : r;
+}
+
+// n/d rounded to nearest, without the 64 bit divide helpers we don't link
+static int32_t sdiv(int64_t n, uint32_t d) {
+    bool neg = n < 0;
+    uint32_t q = K::div64((neg ? -n : n) + d / 2, d);
+    return neg ? -(int32_t) q : (int32_t) q;
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b) {
+    while (b != 0) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+Resampler* Resampler::open(audio_source* source, uint32_t in_rate, uint32_t out_rate, uint32_t channels) {
+    if (in_rate == 0 || out_rate == 0 || channels == 0) return nullptr;
+    auto r = new Resampler(source, in_rate, out_rate, channels);
+
+    uint32_t g = gcd(in_rate, out_rate);
+    r->phases = out_rate / g;
+    r->step = in_rate / g;
+    if (r->phases > MAX_PHASES) {
+        // odd rate pairs don't reduce, use the closest ratio with MAX_PHASES
+        // phases instead. The pitch is off by well under 0.1%.
+        r->step = K::div64((uint64_t) in_rate * MAX_PHASES + out_rate / 2, out_rate);
+        r->phases = MAX_PHASES;
+    }
+    // decimating further than that would need a longer filter
+    if (r->step > 4 * r->phases) {
+        delete r;
+        return nullptr;
+    }
+    r->build_table();
+    return r;
+}
+
+Resampler::Resampler(audio_source* source, uint32_t in_rate, uint32_t out_rate, uint32_t channels) :
+    source(source), in_rate(in_rate), out_rate(out_rate), channels(channels),
+    phases(1), step(1), table(nullptr), ended(false), cycles(0), frames_out(0)
+{
+    uint32_t frame_bytes = channels * 2;
+    capacity = BUFFER_SIZE + 2 * TAPS * frame_bytes;
+    input = new char[capacity];
+
+    // silence before the first frame so the first output is centered on it
+    pos = TAPS / 2 - 1;
+    phase = 0;
+    filled = pos * frame_bytes;
+    bzero(input, filled);
+}
+
+Resampler::~Resampler() {
+    if (frames_out != 0) {
+        uint32_t us = Pit::tscToMicros(cycles);
+        Debug::printf("| resample %d->%d: %d phases x %d taps, %dus of CPU per second of audio\n",
+            in_rate, out_rate, phases, TAPS, K::div64((uint64_t) us * out_rate, frames_out));
+    }
+    delete[] table;
+    delete[] input;
+}
+
+// Tap n of phase p sits at input frame (n + 1 - TAPS/2) relative to the output's
+// integer position, the output itself is p/L past it. The prototype is a sinc
+// with its cutoff at the lower of the two Nyquist frequencies under a Hann window
+// spanning the taps, every phase scaled to unity gain at DC.
+void Resampler::build_table() {
+    // cutoff relative to the input's Nyquist: c = L / cut
+    uint32_t cut = (phases < step) ? step : phases;
+    table = new int16_t[phases * TAPS];
+
+    int32_t coef[TAPS];
+    for (uint32_t p = 0; p < phases; p++) {
+        int64_t sum = 0;
+        for (uint32_t n = 0; n < TAPS; n++) {
+            // t = num / L input frames between the tap and the output
+            int32_t num = ((int32_t) n + 1 - (int32_t) TAPS / 2) * (int32_t) phases - (int32_t) p;
+
+            // c * sinc(c * t) = sin(pi * c * t) / (pi * t)
+            int32_t sinc;
+            if (num == 0) {
+                sinc = K::div64((uint64_t) phases << 30, cut);
+            } else {
+                int64_t s = sin_turns(turns(num, 2 * cut));
+                uint32_t mag = (num < 0) ? -num : num;
+                int64_t top = s * phases * 65536;
+                sinc = sdiv(num < 0 ? -top : top, PI_Q16 * mag);
+            }
+
+            // 1/2 + cos(2 * pi * t / TAPS) / 2
+            int32_t cosine = sin_turns(turns(num, TAPS * phases) + 0x40000000);
+            int32_t window = ONE_Q30 / 2 + cosine / 2;
+
+            coef[n] = (int32_t) (((int64_t) sinc * window) >> 30);
+            sum += coef[n];
+        }
+        ASSERT(sum > 0);
+        for (uint32_t n = 0; n < TAPS; n++) {
+            table[p * TAPS + n] = (int16_t) sdiv((int64_t) coef[n] << 14, (uint32_t) sum);
+        }
+    }
+}
+
+// Make room and read enough input for the next "frames_wanted" outputs (or as
+// much of it as fits)
+void Resampler::pull(uint32_t frames_wanted) {
+    uint32_t frame_bytes = channels * 2;
+
+    // drop the frames no future output reaches back to
+    uint32_t first = pos + 1 - TAPS / 2;
+    uint32_t drop = first * frame_bytes;
+    for (uint32_t i = drop; i < filled; i++) {
+        input[i - drop] = input[i];
+    }
+    filled -= drop;
+    pos -= first;
+
+    uint32_t last = pos + (phase + (frames_wanted - 1) * step) / phases + TAPS / 2;
+    uint32_t need = (last + 1) * frame_bytes - filled;
+    // keep room for the silent tail
+    uint32_t room = capacity - TAPS / 2 * frame_bytes - filled;
+
+    uint32_t n = source->fill(input + filled, K::min(need, room));
+    if (n == 0) {
+        // run the filter into silence so the last frames come out
+        filled = (filled / frame_bytes) * frame_bytes;
+        bzero(input + filled, TAPS / 2 * frame_bytes);
+        filled += TAPS / 2 * frame_bytes;
+        ended = true;
+    } else {
+        filled += n;
+    }
+}
+
+uint32_t Resampler::fill(char* buffer, uint32_t bytes) {
+    uint32_t frame_bytes = channels * 2;
+    uint32_t wanted = bytes / frame_bytes;
+    uint32_t step_whole = step / phases;
+    uint32_t step_frac = step % phases;
+    int16_t* out = (int16_t*) buffer;
+    uint32_t done = 0;
+
+    while (done < wanted) {
+        uint32_t frames = filled / frame_bytes;
+        if (pos + TAPS / 2 >= frames) {
+            if (ended) break;
+            pull(wanted - done);
+            continue;
+        }
+
+        uint64_t start = rdtsc();
+        while (done < wanted && pos + TAPS / 2 < frames) {
+            const int16_t* coef = &table[phase * TAPS];
+            const int16_t* in = (const int16_t*) input + (pos + 1 - TAPS / 2) * channels;
+            for (uint32_t c = 0; c < channels; c++) {
+                int32_t acc = 0;
+                for (uint32_t n = 0; n < TAPS; n++) {
+                    acc += coef[n] * in[n * channels + c];
+                }
+                acc = (acc + (1 << 13)) >> 14;
+                if (acc > 32767) acc = 32767;
+                else if (acc < -32768) acc = -32768;
+                *out++ = (int16_t) acc;
+            }
+            done++;
+
+            pos += step_whole;
+            phase += step_frac;
+            if (phase >= phases) {
+                phase -= phases;
+                pos++;
+            }
+        }
+        cycles += rdtsc() - start;
+    }
+
+    frames_out += done;
+    return done * frame_bytes;
+}
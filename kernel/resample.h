@@ -0,0 +1,49 @@
+#ifndef _resample_h_
+#define _resample_h_
+
+#include "stdint.h"
+#include "audio.h"
+
+namespace audio {
+
+    // Converts a 16 bit source from one sample rate to another with a
+    // polyphase FIR filter. For a rate ratio out/in = L/M the output frame k
+    // sits at input position k*M/L, its fractional part picks one of L phases
+    // of a windowed sinc. The table is built when the stream opens and the
+    // inner loop is all integer math (the kernel doesn't touch the FPU).
+    class Resampler : public audio_source {
+        audio_source* const source;  // not ours, whoever opened the stream owns it
+        const uint32_t in_rate;
+        const uint32_t out_rate;
+        const uint32_t channels;
+        uint32_t phases;             // L
+        uint32_t step;               // M
+        int16_t* table;              // phases x TAPS coefficients, Q14
+        char* input;                 // input frames we still need
+        uint32_t capacity;           // bytes
+        uint32_t filled;             // bytes
+        uint32_t pos;                // frame in input the next output is centered on
+        uint32_t phase;              // and its phase
+        bool ended;                  // the source is done and the tail is in
+
+        uint64_t cycles;             // spent converting
+        uint32_t frames_out;
+
+        Resampler(audio_source* source, uint32_t in_rate, uint32_t out_rate, uint32_t channels);
+        void build_table();
+        void pull(uint32_t frames_wanted);
+    public:
+        static constexpr uint32_t TAPS = 16;
+        static constexpr uint32_t MAX_PHASES = 1024;
+
+        // nullptr if the ratio is out of range
+        static Resampler* open(audio_source* source, uint32_t in_rate, uint32_t out_rate, uint32_t channels);
+
+        // prints what converting cost
+        virtual ~Resampler();
+
+        uint32_t fill(char* buffer, uint32_t bytes) override;
+    };
+}
+
+#endif
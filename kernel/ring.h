@@ -0,0 +1,72 @@
+#ifndef _ring_h_
+#define _ring_h_
+
+#include "stdint.h"
+#include "atomic.h"
+#include "machine.h"
+#include "libk.h"
+#include "debug.h"
+
+// A lock-free single producer / single consumer byte ring
+//
+//    - exactly one thread (or interrupt handler) calls write and one calls read
+//    - head and tail count bytes forever and wrap naturally, size has to
+//      be a power of 2 so the subtraction still works
+//
+class SpscRing {
+    char* const data;
+    const uint32_t size;
+    Atomic<uint32_t> head;  // bytes ever written, only the producer moves it
+    Atomic<uint32_t> tail;  // bytes ever read, only the consumer moves it
+public:
+    SpscRing(uint32_t size) : data(new char[size]), size(size), head(0), tail(0) {
+        ASSERT((size & (size - 1)) == 0);
+    }
+
+    ~SpscRing() {
+        delete[] data;
+    }
+
+    SpscRing(const SpscRing&) = delete;
+
+    uint32_t readable() {
+        return head.get() - tail.get();
+    }
+
+    uint32_t writable() {
+        return size - readable();
+    }
+
+    // producer side, returns how many bytes fit
+    uint32_t write(const char* buffer, uint32_t n) {
+        n = K::min(n, writable());
+        uint32_t h = head.get();
+        uint32_t at = h & (size - 1);
+        uint32_t first = K::min(n, size - at);
+        memcpy(&data[at], buffer, first);
+        memcpy(data, buffer + first, n - first);
+        head.set(h + n);
+        return n;
+    }
+
+    // consumer side, returns how many bytes were there
+    uint32_t read(char* buffer, uint32_t n) {
+        n = K::min(n, readable());
+        uint32_t t = tail.get();
+        uint32_t at = t & (size - 1);
+        uint32_t first = K::min(n, size - at);
+        memcpy(buffer, &data[at], first);
+        memcpy(buffer + first, data, n - first);
+        tail.set(t + n);
+        return n;
+    }
+
+    // consumer side, drops up to n bytes without looking at them
+    uint32_t skip(uint32_t n) {
+        n = K::min(n, readable());
+        tail.set(tail.get() + n);
+        return n;
+    }
+};
+
+#endif
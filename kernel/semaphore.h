@@ -5,6 +5,9 @@
 #include "atomic.h"
 #include "queue.h"
 #include "threads.h"
+#include "slab.h"
+#include "timer.h"
+#include "pit.h"
 
 class Semaphore {
     uint64_t volatile count;
@@ -16,6 +19,9 @@ public:
 
     Semaphore(const Semaphore&) = delete;
 
+    static void* operator new(size_t size) { return Slab::semaphores.alloc(size); }
+    static void operator delete(void* p, size_t size) { Slab::semaphores.free(p, size); }
+
     void down() {
         using namespace gheith;
 
@@ -41,6 +47,61 @@ public:
         if (was) cli(); else sti();
     }
 
+    // like down() but gives up after the given number of jiffies,
+    // returns false if it did
+    bool down(uint32_t timeout) {
+        using namespace gheith;
+
+        struct Wait {
+            Semaphore* sem;
+            TCB* tcb;
+            bool blocked;
+            bool timed_out;
+        } w { this, nullptr, false, false };
+
+        // armed before we take the lock, the wheel calls in with its lock
+        // held and takes ours
+        Timer timer;
+        timer.arg = &w;
+        timer.fn = [](void* arg) {
+            auto w = (Wait*) arg;
+            auto was = w->sem->lock.lock();
+            if (!w->blocked) {
+                // still on the way in, down sees it before it blocks
+                w->timed_out = true;
+            } else if (w->sem->waiting.remove(w->tcb)) {
+                w->timed_out = true;
+                schedule(w->tcb);
+            }
+            w->sem->lock.unlock(was);
+        };
+        TimerWheel::add(&timer, Pit::jiffies + timeout);
+
+        auto was = lock.lock();
+
+        if (count > 0 || w.timed_out) {
+            bool got = (count > 0);
+            if (got) count--;
+            lock.unlock(was);
+            TimerWheel::cancel(&timer);
+            return got;
+        }
+
+        block(BlockOption::MustBlock,[this, &w](TCB* me) {
+            ASSERT(!me->isIdle);
+            w.tcb = me;
+            w.blocked = true;
+            waiting.add(me);
+            lock.unlock(true);
+        });
+
+        if (was) cli(); else sti();
+
+        // up() may have beaten the timer, make sure it's done with w
+        TimerWheel::cancel(&timer);
+        return !w.timed_out;
+    }
+
     void up() {
         using namespace gheith;
 
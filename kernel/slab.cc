@@ -0,0 +1,163 @@
+#include "slab.h"
+#include "physmem.h"
+#include "heap.h"
+#include "debug.h"
+#include "threads.h"
+#include "process.h"
+#include "semaphore.h"
+
+namespace Slab {
+    // TCBImpl<T> carries the thread's lambda, 128 bytes covers the ones we
+    // start today. Bigger ones fall through to the heap.
+    SlabCache tcbs{"tcb", 128};
+    SlabCache pcbs{"pcb", sizeof(PCB)};
+    SlabCache fds{"fd", sizeof(FileDescriptor)};
+    SlabCache nodes{"node", sizeof(Node)};
+    SlabCache semaphores{"semaphore", sizeof(Semaphore)};
+}
+
+static SlabPage* slab_of(void* p) {
+    return (SlabPage*) PhysMem::framedown((uint32_t) p);
+}
+
+SlabPage* SlabCache::grow() {
+    if (per_slab == 0) {
+        Debug::panic("*** slab cache %s: %d byte objects don't fit in a frame", name, size);
+    }
+
+    SlabPage* slab;
+    void* block = nullptr;
+    if (PhysMem::ready()) {
+        slab = (SlabPage*) PhysMem::alloc_frame();
+    } else {
+        // the heap comes up before physmem and global constructors already
+        // make objects, take an aligned frame out of it. We can't hand it
+        // back from under our lock (the heap sleeps) so it stays a slab.
+        block = malloc(2 * PhysMem::FRAME_SIZE);
+        if (block == nullptr) Debug::panic("*** slab cache %s: out of memory", name);
+        slab = (SlabPage*) PhysMem::frameup((uint32_t) block);
+    }
+
+    slab->next = nullptr;
+    slab->prev = nullptr;
+    slab->cache = this;
+    slab->heap_block = block;
+    slab->in_use = 0;
+
+    // thread the slots onto the free list, first slot at the head
+    char* first = (char*) (slab + 1);
+    slab->free = nullptr;
+    for (uint32_t i = per_slab; i > 0; i--) {
+        void** slot = (void**) (first + (i - 1) * size);
+        *slot = slab->free;
+        slab->free = slot;
+    }
+
+    slabs++;
+    return slab;
+}
+
+void SlabCache::release(SlabPage* slab) {
+    slabs--;
+    PhysMem::dealloc_frame((uint32_t) slab);
+}
+
+// called with the lock held
+void* SlabCache::take() {
+    SlabPage* slab = partial;
+    if (slab == nullptr) {
+        if (spare != nullptr) {
+            slab = spare;
+            spare = nullptr;
+        } else {
+            slab = grow();
+        }
+        slab->next = nullptr;
+        slab->prev = nullptr;
+        partial = slab;
+    }
+
+    void** p = (void**) slab->free;
+    slab->free = *p;
+    slab->in_use++;
+
+    if (slab->free == nullptr) {
+        // full, forget about it until something comes back
+        partial = slab->next;
+        if (partial != nullptr) partial->prev = nullptr;
+        slab->next = nullptr;
+    }
+
+    return p;
+}
+
+// called with the lock held
+void SlabCache::give(void* p) {
+    SlabPage* slab = slab_of(p);
+    ASSERT(slab->cache == this);
+
+    bool was_full = (slab->free == nullptr);
+    *(void**) p = slab->free;
+    slab->free = p;
+    slab->in_use--;
+
+    if (was_full) {
+        slab->prev = nullptr;
+        slab->next = partial;
+        if (partial != nullptr) partial->prev = slab;
+        partial = slab;
+    }
+
+    if (slab->in_use == 0 && slab->heap_block == nullptr) {
+        if (slab->prev != nullptr) {
+            slab->prev->next = slab->next;
+        } else {
+            partial = slab->next;
+        }
+        if (slab->next != nullptr) slab->next->prev = slab->prev;
+
+        // keep one around so a create/destroy loop doesn't bounce frames
+        if (spare == nullptr) {
+            spare = slab;
+        } else {
+            release(slab);
+        }
+    }
+}
+
+void* SlabCache::alloc(size_t object_size) {
+    if (object_size > size) return ::operator new(object_size);
+
+    bool was = Interrupts::disable();
+    Magazine& mag = magazines.forCPU(SMP::early_me());
+    if (mag.count == 0) {
+        // refill half way so the next few frees have room too
+        LockGuard g{lock};
+        while (mag.count < MAGAZINE / 2) {
+            mag.objs[mag.count++] = take();
+        }
+    }
+    void* p = mag.objs[--mag.count];
+    Interrupts::restore(was);
+
+    return p;
+}
+
+void SlabCache::free(void* p, size_t object_size) {
+    if (p == nullptr) return;
+    if (object_size > size) {
+        ::operator delete(p);
+        return;
+    }
+
+    bool was = Interrupts::disable();
+    Magazine& mag = magazines.forCPU(SMP::early_me());
+    if (mag.count == MAGAZINE) {
+        LockGuard g{lock};
+        while (mag.count > MAGAZINE / 2) {
+            give(mag.objs[--mag.count]);
+        }
+    }
+    mag.objs[mag.count++] = p;
+    Interrupts::restore(was);
+}
@@ -0,0 +1,82 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include "stdint.h"
+#include "atomic.h"
+#include "smp.h"
+
+// Object caches for the small kernel objects we make and destroy all the
+// time (threads, processes, open files, i-nodes, semaphores).
+//
+// Each cache carves 4K frames into equal sized slots. Freed slots go to a
+// small per-CPU magazine first so the common new/delete pair never touches
+// a shared lock, only a full or empty magazine goes to the slabs.
+//
+// A type opts in with class-level operators:
+//
+//     static void* operator new(size_t size) { return Slab::pcbs.alloc(size); }
+//     static void operator delete(void* p, size_t size) { Slab::pcbs.free(p, size); }
+//
+// Anything bigger than the slot (a subclass with more fields) is passed on
+// to the heap, so the sized delete has to be used.
+
+struct SlabPage;
+
+class SlabCache {
+    constexpr static uint32_t MAGAZINE = 16;
+
+    struct Magazine {
+        uint32_t count;
+        void* objs[MAGAZINE];
+    };
+
+    const char* const name;
+    const uint32_t size;       // slot size, a multiple of 8
+    const uint32_t per_slab;
+
+    InterruptSafeLock lock;
+    SlabPage* partial;         // slabs with at least one free slot
+    SlabPage* spare;           // one empty slab we keep instead of freeing
+    uint32_t slabs;
+
+    PerCPU<Magazine> magazines;
+
+    void* take();
+    void give(void* p);
+    SlabPage* grow();
+    void release(SlabPage* slab);
+
+public:
+    constexpr SlabCache(const char* name, uint32_t object_size);
+
+    SlabCache(const SlabCache&) = delete;
+
+    void* alloc(size_t object_size);
+    void free(void* p, size_t object_size);
+};
+
+struct SlabPage {
+    SlabPage* next;
+    SlabPage* prev;
+    SlabCache* cache;
+    void* free;                // free slots in this slab
+    void* heap_block;          // not null if the frame came out of the heap
+    uint32_t in_use;
+    uint32_t pad;              // keeps the slots 8 byte aligned
+};
+
+constexpr SlabCache::SlabCache(const char* name, uint32_t object_size) :
+    name(name),
+    size((object_size + 7) & ~7),
+    per_slab((4096 - sizeof(SlabPage)) / ((object_size + 7) & ~7)),
+    lock(), partial(nullptr), spare(nullptr), slabs(0), magazines() {}
+
+namespace Slab {
+    extern SlabCache tcbs;
+    extern SlabCache pcbs;
+    extern SlabCache fds;
+    extern SlabCache nodes;
+    extern SlabCache semaphores;
+}
+
+#endif
@@ -50,6 +50,8 @@ void SMP::init(bool isFirst) {
         // Register spurious interrupt handler
         IDT::interrupt(0xff, (uint32_t) spuriousHandler_);
 
+        IDT::interrupt(RESCHED_VECTOR, (uint32_t) reschedHandler_);
+
     }
 
     // disable PIC
@@ -62,3 +64,8 @@ void SMP::init(bool isFirst) {
 
     spurious.set(0x1ff);
 }
+
+// nothing to do, being interrupted is enough to get out of mwait
+extern "C" void reschedHandler() {
+    SMP::eoi();
+}
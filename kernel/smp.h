@@ -22,10 +22,16 @@ public:
     static AtomicPtr<uint32_t> apit_current_count;
     static AtomicPtr<uint32_t> apit_divide;
     static const char* names[MAX_PROCS];
+
+    // wakes an idle core so it looks at the ready queues again
+    static constexpr uint32_t RESCHED_VECTOR = 41;
 public:
     static void init(bool isFirst);
     static uint32_t me() { return (id.get() >> 24); }
     static const char* name() { return names[me()]; }
+
+    // me() needs the LAPIC, before SMP::init only the BSP is running
+    static uint32_t early_me() { return (running == 0) ? 0 : me(); }
     static void eoi() { eoi_reg = 0; }
 
     static void ipi(uint32_t id, uint32_t num) {
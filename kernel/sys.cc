@@ -15,18 +15,39 @@
 #include "process.h"
 #include "pci.h"
 #include "audio.h"
+#include "wav.h"
+#include "mixer.h"
+#include "timer.h"
+#include "pit.h"
+
+// the writer drops the stream, the mixer frees it once it has played out
+static void audio_close(PCB* pcb, uint32_t i) {
+    auto ring = pcb->as[i];
+    pcb->as[i] = nullptr;
+    ring->close();
+    audio::primary->mixer->detach(ring->id);
+}
 
 extern "C" int sysHandler(uint32_t eax, uint32_t *frame) {
     auto me = gheith::current();
     auto my_pcb = me->pcb;
     uint32_t* user_esp = (uint32_t*)frame[3];
     auto root = fs->root;
+    // the audio calls (14 to 20) need a controller
+    if (eax >= 14 && eax <= 20 && audio::audio_controller() == nullptr) {
+        return -1;
+    }
     switch (eax) 
     {
         case 0: // exit process
         {
             // grab exit code off stack
             int rc = user_esp[1];
+            // let open audio streams play out
+            for (uint32_t i = 0; i < 10; i++) {
+                if (my_pcb->as[i] != nullptr) audio_close(my_pcb, i);
+            }
+            if (audio::primary != nullptr) audio::audio_munmap(audio::primary, me->pd);
             // set future to exit code
             my_pcb->future->set(rc);
             // stop should handle all deallocation through zombie queue deletion
@@ -79,7 +100,7 @@ extern "C" int sysHandler(uint32_t eax, uint32_t *frame) {
             auto child_tcb = get_thread([eip, esp] {
                 // what arguments here? EIP and ESP
                 switchToUser(eip, esp, 0);
-            });
+            }, me->rt);
             // time to set up new child process' values. copy over file descriptors and semaphores.
             for (int i = 0; i < 10; i++) {
                 child_tcb->pcb->fd[i] = my_pcb->fd[i];
@@ -91,7 +112,8 @@ extern "C" int sysHandler(uint32_t eax, uint32_t *frame) {
             // now need to deep copy memory. traverse parent tree
             int page_size = 4096;
             int num_entries = 1024;
-            int treeStart = kConfig.memSize / page_size / num_entries + 1;
+            // private space starts at 0x80000000, below that is the kernel's
+            int treeStart = 0x80000000 / page_size / num_entries;
             for (int pdi = treeStart; pdi < 1024; pdi++) {
                 // looping through page directory
                 auto parent_pde = me->pd[pdi];
@@ -112,6 +134,8 @@ extern "C" int sysHandler(uint32_t eax, uint32_t *frame) {
                         } else if (va == kConfig.localAPIC) {
                             child_frame = kConfig.localAPIC | 7;
                             gheith::map(child_tcb->pd, kConfig.localAPIC, child_frame);
+                        } else if (va >= audio::AUDIO_MMAP_VA && va <= audio::AUDIO_MMAP_VA + BDL_SIZE * BUFFER_SIZE) {
+                            // the DMA buffers stay with the process that mapped them
                         } else if (parent_frame & 1) {
                             // parent frame present and not an apic - deep copy physical frame and map
                             child_frame = PhysMem::alloc_frame() | 7;
@@ -167,7 +191,7 @@ extern "C" int sysHandler(uint32_t eax, uint32_t *frame) {
             uint32_t num = user_esp[1];
 
             // validity bounds checking - is num in range of our arrays or not?
-            if (num < 0 || num > 29) {
+            if (num < 0 || num > 39) {
                 return -1;
             }
             if (num < 10) {
@@ -195,6 +219,12 @@ extern "C" int sysHandler(uint32_t eax, uint32_t *frame) {
                     return -1;
                 }
                 my_pcb->cp[num - 20] = nullptr;
+            } else {
+                // audio stream
+                if (my_pcb->as[num - 30] == nullptr) {
+                    return -1;
+                }
+                audio_close(my_pcb, num - 30);
             }
             return 0;
         }
@@ -389,10 +419,164 @@ extern "C" int sysHandler(uint32_t eax, uint32_t *frame) {
         case 14: // play
         {
             uint32_t fd = user_esp[1];
+            // validity checks
+            if (fd < 0 || fd > 9) {
+                return -1;
+            }
             auto file = my_pcb->fd[fd];
-            PCI::pci_device* dev = new PCI::pci_device();
-            init_dev(dev);
+            if (file == nullptr || file->reserved) {
+                return -1;
+            }
+            auto wav = audio::WavSource::open(file->file);
+            if (wav == nullptr) {
+                return -1;
+            }
+            // samples go to the codec as they are in the file, 24 bit
+            // wavs pack 3 byte samples the codec can't take
+            audio::audio_sample_format format;
+            switch (wav->fmt.bits_per_sample) {
+                case 8: format = audio::AUDIO_8SI; break;
+                case 16: format = audio::AUDIO_16SI; break;
+                case 32: format = audio::AUDIO_32SI; break;
+                default:
+                    delete wav;
+                    return -1;
+            }
+            auto hda = audio::audio_controller();
+            // the refill thread reads the samples into the BDL buffers one chunk at a time
+            int rc = audio::audio_play(hda, wav, wav->fmt.sample_rate, wav->fmt.channels, format);
+            Debug::printf("| wav: %d bytes read in place, %d bytes bounced\n", wav->direct_bytes, wav->bounced_bytes);
+            delete wav;
+            return rc;
+        }
+        case 15: // audio_open
+        {
+            uint32_t rate = user_esp[1];
+            uint32_t channels = user_esp[2];
+            if (channels == 0) return -1;
+            int i = 0;
+            while (i < 10 && my_pcb->as[i] != nullptr) i++;
+            if (i == 10) return -1;
 
+            auto hda = audio::audio_controller();
+            // two periods of slack between the process and the mixer
+            auto ring = new audio::RingSource(2 * BUFFER_SIZE);
+            ring->frame_bytes = 2 * channels;
+            ring->id = hda->mixer->open(ring, rate, channels, audio::AUDIO_16SI);
+            if (ring->id < 0) {
+                delete ring;
+                return -1;
+            }
+            my_pcb->as[i] = ring;
+            return i + 30;
+        }
+        case 16: // audio_write
+        {
+            uint32_t id = user_esp[1];
+            if (id < 30 || id > 39 || my_pcb->as[id - 30] == nullptr) {
+                return -1;
+            }
+            uint32_t buffer_addr = user_esp[2];
+            uint32_t nbyte = user_esp[3];
+            // the samples have to come from private space
+            if (buffer_addr < 0x80000000 || buffer_addr + nbyte < buffer_addr
+                || (buffer_addr >= kConfig.localAPIC && buffer_addr < kConfig.localAPIC + 4096)
+                || (buffer_addr >= kConfig.ioAPIC && buffer_addr < kConfig.ioAPIC + 4096)) {
+                return -1;
+            }
+            return my_pcb->as[id - 30]->write((const char*) buffer_addr, nbyte);
+        }
+        case 17: // record
+        {
+            uint32_t buffer_addr = user_esp[1];
+            uint32_t nbyte = user_esp[2];
+            auto hda = audio::audio_controller();
+            if (nbyte == 0) {
+                audio::audio_record_stop(hda);
+                return 0;
+            }
+            // the samples go to private space
+            if (buffer_addr < 0x80000000 || buffer_addr + nbyte < buffer_addr
+                || (buffer_addr >= kConfig.localAPIC && buffer_addr < kConfig.localAPIC + 4096)
+                || (buffer_addr >= kConfig.ioAPIC && buffer_addr < kConfig.ioAPIC + 4096)) {
+                return -1;
+            }
+            return audio::audio_record(hda, (char*) buffer_addr, nbyte);
+        }
+        case 18: // audio_clock
+        {
+            uint32_t id = user_esp[1];
+            uint32_t clock_addr = user_esp[2];
+            if (clock_addr < 0x80000000 || clock_addr + 5 * sizeof(uint32_t) < clock_addr
+                || (clock_addr >= kConfig.localAPIC && clock_addr < kConfig.localAPIC + 4096)
+                || (clock_addr >= kConfig.ioAPIC && clock_addr < kConfig.ioAPIC + 4096)) {
+                return -1;
+            }
+            audio::audio_clock clock;
+            audio::audio_get_clock(audio::audio_controller(), &clock);
+            uint32_t* out = (uint32_t*) clock_addr;
+            out[0] = clock.position;
+            out[1] = clock.queued;
+            out[2] = clock.jiffies;
+            out[3] = clock.rate;
+            // frames the stream has written that the mixer hasn't picked up yet
+            out[4] = 0;
+            if (id >= 30 && id <= 39 && my_pcb->as[id - 30] != nullptr) {
+                out[4] = my_pcb->as[id - 30]->buffered() / my_pcb->as[id - 30]->frame_bytes;
+            }
+            return 0;
+        }
+        case 19: // audio_stats
+        {
+            uint32_t id = user_esp[1];
+            uint32_t stats_addr = user_esp[2];
+            if (stats_addr < 0x80000000 || stats_addr + 5 * sizeof(uint32_t) < stats_addr
+                || (stats_addr >= kConfig.localAPIC && stats_addr < kConfig.localAPIC + 4096)
+                || (stats_addr >= kConfig.ioAPIC && stats_addr < kConfig.ioAPIC + 4096)) {
+                return -1;
+            }
+            audio::audio_xruns& xruns = audio::audio_controller()->xruns;
+            uint32_t* out = (uint32_t*) stats_addr;
+            out[0] = xruns.periods;
+            out[1] = xruns.underruns;
+            out[2] = xruns.silenced;
+            out[3] = xruns.overruns;
+            // periods the stream's writer fell behind the mixer
+            out[4] = 0;
+            if (id >= 30 && id <= 39 && my_pcb->as[id - 30] != nullptr) {
+                out[4] = my_pcb->as[id - 30]->underruns;
+            }
+            return 0;
+        }
+        case 20: // audio_mmap
+        {
+            uint32_t rate = user_esp[1];
+            uint32_t channels = user_esp[2];
+            auto hda = audio::audio_controller();
+            if (rate == 0) {
+                audio::audio_munmap(hda, me->pd);
+                return 0;
+            }
+            return audio::audio_mmap(hda, me->pd, rate, channels);
+        }
+        case 21: // set_priority
+        {
+            // 0 is normal, 1 to RT_LEVELS - 1 are real-time. The top level
+            // is for the kernel's own threads (the audio engine), a process
+            // up there could starve them. Takes effect the next time we're
+            // scheduled, fork passes it on
+            uint32_t rt = user_esp[1];
+            if (rt >= gheith::RT_LEVELS) return -1;
+            uint32_t was = me->rt;
+            me->rt = rt;
+            return was;
+        }
+        case 22: // sleep
+        {
+            uint32_t ms = user_esp[1];
+            // the jiffy we're in is already partly gone
+            sleep_jiffies(Pit::millisToJiffies(ms) + (ms != 0));
+            return 0;
         }
         default:
         {
@@ -9,6 +9,7 @@
 #include "vmm.h"
 #include "process.h"
 #include "future.h"
+#include "pit.h"
 
 namespace gheith {
     Atomic<uint32_t> TCB::next_id{0};
@@ -16,7 +17,17 @@ namespace gheith {
     TCB** activeThreads;
     TCB** idleThreads;
 
-    Queue<TCB,InterruptSafeLock> readyQ{};
+    PerCPU<Queue<TCB,InterruptSafeLock>> readyQs{};
+
+    // real-time threads are few, they share one queue per level
+    Queue<TCB,InterruptSafeLock> rtQs[RT_LEVELS];
+    Atomic<uint32_t> rt_ready[RT_LEVELS] = {0,0,0,0,0,0,0,0};
+
+    // set while a core sleeps in idle_wait, whoever clears it sends the IPI
+    struct Idle {
+        Atomic<bool> sleeping{false};
+    };
+    PerCPU<Idle> idlers{};
     Queue<TCB,InterruptSafeLock> zombies{};
 
     TCB* current() {
@@ -44,10 +55,86 @@ namespace gheith {
         }
     }
 
-    void schedule(TCB* tcb) {
-        if (!tcb->isIdle) {
-            readyQ.add(tcb);
+    uint32_t rt_waiting() {
+        for (uint32_t level = RT_LEVELS; level > 0; level--) {
+            if (rt_ready[level-1] != 0) return level;
+        }
+        return 0;
+    }
+
+    TCB* next_ready(uint32_t core_id) {
+        for (uint32_t level = rt_waiting(); level > 0; level--) {
+            auto it = rtQs[level-1].remove();
+            if (it != nullptr) {
+                rt_ready[level-1].add_fetch(-1);
+                return it;
+            }
+        }
+
+        auto it = readyQs.forCPU(core_id).remove();
+        if (it != nullptr) return it;
+
+        // nothing here, take the oldest thread from the next core that has one
+        for (uint32_t i = 1; i < kConfig.totalProcs; i++) {
+            it = readyQs.forCPU((core_id + i) % kConfig.totalProcs).remove();
+            if (it != nullptr) return it;
+        }
+        return nullptr;
+    }
+
+    static bool work_waiting() {
+        if (rt_waiting() != 0) return true;
+        for (uint32_t i = 0; i < kConfig.totalProcs; i++) {
+            if (!readyQs.forCPU(i).empty()) return true;
         }
+        return false;
+    }
+
+    // Idle cores other than 0 (it keeps the jiffies and the timer wheel)
+    // turn their tick off and wait for a reschedule IPI. The flag is set
+    // before we look at the queues and monitored so a wakeup that comes
+    // in between still gets us out of mwait.
+    void idle_wait(uint32_t core_id) {
+        auto& idle = idlers.forCPU(core_id);
+        idle.sleeping.set(true);
+        idle.sleeping.monitor_value();
+        if (idle.sleeping.get() && !work_waiting()) {
+            if (core_id != 0) Pit::stopTicks();
+            iAmStuckInALoop(true);
+            if (core_id != 0) Pit::startTicks();
+        }
+        idle.sleeping.set(false);
+    }
+
+    // someone has work, let one sleeping core come and steal it
+    static void wake_idle(uint32_t me) {
+        for (uint32_t i = 0; i < kConfig.totalProcs; i++) {
+            if (i == me) continue;
+            auto& idle = idlers.forCPU(i);
+            if (idle.sleeping.get() && idle.sleeping.exchange(false)) {
+                Interrupts::protect([i] {
+                    SMP::ipi(i, SMP::RESCHED_VECTOR);
+                });
+                return;
+            }
+        }
+    }
+
+    static void enqueue(TCB* tcb) {
+        if (tcb->rt != 0) {
+            rtQs[tcb->rt-1].add(tcb);
+            rt_ready[tcb->rt-1].add_fetch(1);
+        } else {
+            readyQs.forCPU(SMP::early_me()).add(tcb);
+        }
+    }
+
+    // The thread goes on the queue of the core that wakes it, it is likely
+    // still warm in that core's cache
+    void schedule(TCB* tcb) {
+        if (tcb->isIdle) return;
+        enqueue(tcb);
+        wake_idle(SMP::early_me());
     }
 
     struct IdleTcb: public TCB {
@@ -98,8 +185,9 @@ void threadsInit() {
 
 void yield() {
     using namespace gheith;
+    // back on our own queue, it isn't new work so nobody needs waking
     block(BlockOption::CanReturn,[](TCB* me) {
-        schedule(me);
+        if (!me->isIdle) enqueue(me);
     });
 }
 
@@ -9,6 +9,7 @@
 #include "shared.h"
 #include "vmm.h"
 #include "tss.h"
+#include "slab.h"
 
 struct PCB;
 
@@ -17,6 +18,12 @@ namespace gheith {
     constexpr static int STACK_BYTES = 8 * 1024;
     constexpr static int STACK_WORDS = STACK_BYTES / sizeof(uint32_t);
 
+    // Real-time priorities are 1 to RT_LEVELS, 0 is the normal class. Only
+    // kernel threads get RT_LEVELS, processes can ask for the ones below.
+    // A ready real-time thread always runs before any normal one and is
+    // only preempted by real-time threads at its level or above.
+    constexpr static uint32_t RT_LEVELS = 8;
+
     struct TCB;
 
     struct SaveArea {
@@ -46,12 +53,17 @@ namespace gheith {
 
         PCB* pcb;
 
+        uint32_t rt = 0;
+
         TCB(bool isIdle);
 
         virtual ~TCB();
 
         virtual void doYourThing() = 0;
         virtual uint32_t interruptEsp() = 0;
+
+        static void* operator new(size_t size) { return Slab::tcbs.alloc(size); }
+        static void operator delete(void* p, size_t size) { Slab::tcbs.free(p, size); }
     };
 
     extern "C" void gheith_contextSwitch(gheith::SaveArea *, gheith::SaveArea *, void* action, void* arg);
@@ -60,7 +72,15 @@ namespace gheith {
     extern TCB** idleThreads;
 
     extern TCB* current();
-    extern Queue<TCB,InterruptSafeLock> readyQ;
+    // one ready queue per core, a core with nothing to do steals from the others
+    extern PerCPU<Queue<TCB,InterruptSafeLock>> readyQs;
+    extern TCB* next_ready(uint32_t core_id);
+
+    // highest real-time level with a thread ready to run, 0 if none
+    extern uint32_t rt_waiting();
+
+    // an idle core with nothing to run sleeps here until there is
+    extern void idle_wait(uint32_t core_id);
     extern void entry();
     extern void schedule(TCB*);
     extern void delete_zombies();
@@ -97,8 +117,8 @@ namespace gheith {
         });
         
     again:
-        readyQ.monitor_add();
-        auto next_tcb = readyQ.remove();
+        readyQs.forCPU(core_id).monitor_add();
+        auto next_tcb = next_ready(core_id);
         if (next_tcb == nullptr) {
             if (blockOption == BlockOption::CanReturn) return;
             if (me->isIdle) {
@@ -107,7 +127,7 @@ namespace gheith {
                 ASSERT(!Interrupts::isDisabled());
                 ASSERT(me == idleThreads[core_id]);
                 ASSERT(me == activeThreads[core_id]);
-                iAmStuckInALoop(true);
+                idle_wait(core_id);
                 goto again;
             }
             next_tcb = idleThreads[core_id];    
@@ -169,24 +189,27 @@ extern void stop();
 extern void yield();
 
 
+// rt is the real-time priority (see gheith::RT_LEVELS), 0 for a normal thread
 template <typename T>
-void thread(T work) {
+void thread(T work, uint32_t rt = 0) {
     using namespace gheith;
 
     delete_zombies();
 
     auto tcb = new TCBImpl<T>(work);
+    tcb->rt = rt;
     schedule(tcb);
 
 }
 
 template <typename T>
-gheith::TCB* get_thread(T work) {
+gheith::TCB* get_thread(T work, uint32_t rt = 0) {
     using namespace gheith;
 
     delete_zombies();
 
     auto tcb = new TCBImpl<T>(work);
+    tcb->rt = rt;
     return tcb;
 }
 
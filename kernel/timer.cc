@@ -0,0 +1,225 @@
+#include "timer.h"
+#include "atomic.h"
+#include "debug.h"
+#include "pit.h"
+#include "threads.h"
+#include "smp.h"
+#include "machine.h"
+
+// A hierarchical timer wheel. Level 0 has a slot per jiffy for the next
+// 256 jiffies, each level above has 64 slots that each cover a whole
+// turn of the level below. When a level below wraps around, the next
+// slot of the level above is spread out over it. Adding, cancelling and
+// firing a timer are O(1), cascading touches every timer log_64(delay)
+// times at most.
+//
+// The wheel keeps its own 64 bit jiffy count so the slot arithmetic never
+// sees Pit::jiffies wrap, a timer is placed by how far out it is.
+
+namespace TimerWheel {
+
+    constexpr uint32_t LEVELS = 4;
+    constexpr uint32_t ROOT_BITS = 8;
+    constexpr uint32_t LEVEL_BITS = 6;
+    constexpr uint32_t ROOT_SLOTS = 1 << ROOT_BITS;
+    constexpr uint32_t LEVEL_SLOTS = 1 << LEVEL_BITS;
+
+    static Timer* root[ROOT_SLOTS];
+    static Timer* levels[LEVELS - 1][LEVEL_SLOTS];
+
+    static InterruptSafeLock lock{};
+    static uint64_t now = 0;        // the last jiffy we processed, never wraps
+
+    static uint32_t shift(uint32_t level) {
+        return ROOT_BITS + (level - 1) * LEVEL_BITS;
+    }
+
+    static void push(Timer** slot, Timer* t) {
+        t->next = *slot;
+        if (t->next != nullptr) t->next->pprev = &t->next;
+        t->pprev = slot;
+        *slot = t;
+    }
+
+    static void unlink(Timer* t) {
+        *t->pprev = t->next;
+        if (t->next != nullptr) t->next->pprev = t->pprev;
+        t->next = nullptr;
+        t->pprev = nullptr;
+    }
+
+    static Timer** slot_of(Timer* t) {
+        uint64_t e = t->expires;
+        if (e <= now) e = now + 1;
+
+        if ((e >> ROOT_BITS) == (now >> ROOT_BITS)) {
+            return &root[e & (ROOT_SLOTS - 1)];
+        }
+        for (uint32_t level = 1; level < LEVELS; level++) {
+            uint32_t s = shift(level);
+            if ((e >> s) - (now >> s) < LEVEL_SLOTS) {
+                return &levels[level - 1][(e >> s) & (LEVEL_SLOTS - 1)];
+            }
+        }
+
+        // too far out, park it in the last slot we have and look again then
+        uint32_t s = shift(LEVELS - 1);
+        return &levels[LEVELS - 2][((now >> s) - 1) & (LEVEL_SLOTS - 1)];
+    }
+
+    // called with the lock held
+    static void insert(Timer* t) {
+        push(slot_of(t), t);
+    }
+
+    static void cascade(uint32_t level) {
+        Timer** slot = &levels[level - 1][(now >> shift(level)) & (LEVEL_SLOTS - 1)];
+        Timer* t = *slot;
+        *slot = nullptr;
+        while (t != nullptr) {
+            Timer* next = t->next;
+            insert(t);
+            t = next;
+        }
+    }
+
+    void add(Timer* t, uint32_t expires) {
+        LockGuard g{lock};
+        ASSERT(!t->pending);
+        // a jiffy up to 2^31 behind or ahead of where we are
+        t->expires = now + int32_t(expires - (uint32_t) now);
+        t->pending = true;
+        insert(t);
+    }
+
+    bool cancel(Timer* t) {
+        LockGuard g{lock};
+        if (!t->pending) return false;
+        unlink(t);
+        t->pending = false;
+        return true;
+    }
+
+    void tick() {
+        LockGuard g{lock};
+        while ((uint32_t) now != Pit::jiffies) {
+            now++;
+
+            // the higher levels first, they may drop timers into the lower ones
+            for (uint32_t level = LEVELS - 1; level > 0; level--) {
+                if ((now & ((1 << shift(level)) - 1)) == 0) cascade(level);
+            }
+
+            Timer** slot = &root[now & (ROOT_SLOTS - 1)];
+            while (*slot != nullptr) {
+                Timer* t = *slot;
+                unlink(t);
+                t->pending = false;
+                // the owner may be gone as soon as fn returns, don't touch t after
+                t->fn(t->arg);
+            }
+        }
+    }
+}
+
+void sleep_jiffies(uint32_t n) {
+    using namespace gheith;
+
+    if (n == 0) {
+        yield();
+        return;
+    }
+
+    Timer t;
+    t.fn = [](void* arg) {
+        schedule((TCB*) arg);
+    };
+
+    block(BlockOption::MustBlock, [&t, n](TCB* me) {
+        ASSERT(!me->isIdle);
+        t.arg = me;
+        TimerWheel::add(&t, Pit::jiffies + n);
+    });
+}
+
+// Each core keeps its high resolution timers in a list sorted by deadline,
+// there are only ever a few of them
+namespace HrTimers {
+
+    struct Queue {
+        InterruptSafeLock lock{};
+        HrTimer* first = nullptr;
+    };
+
+    static PerCPU<Queue> queues;
+
+    void add(HrTimer* t, uint64_t deadline) {
+        bool was = Interrupts::disable();
+        uint32_t core = SMP::me();
+        auto& q = queues.forCPU(core);
+        bool earliest;
+        {
+            LockGuard g{q.lock};
+            ASSERT(!t->pending);
+            t->deadline = deadline;
+            t->core = core;
+            t->pending = true;
+
+            HrTimer** p = &q.first;
+            while (*p != nullptr && (*p)->deadline <= deadline) p = &(*p)->next;
+            t->next = *p;
+            *p = t;
+            earliest = (q.first == t);
+        }
+        if (earliest) Pit::reprogram();
+        Interrupts::restore(was);
+    }
+
+    bool cancel(HrTimer* t) {
+        auto& q = queues.forCPU(t->core);
+        LockGuard g{q.lock};
+        if (!t->pending) return false;
+
+        // the interrupt it had armed finds nothing and reprograms
+        HrTimer** p = &q.first;
+        while (*p != t) p = &(*p)->next;
+        *p = t->next;
+        t->next = nullptr;
+        t->pending = false;
+        return true;
+    }
+
+    uint64_t next(uint32_t core) {
+        auto& q = queues.forCPU(core);
+        LockGuard g{q.lock};
+        return (q.first == nullptr) ? ~uint64_t(0) : q.first->deadline;
+    }
+
+    void expire(uint32_t core, uint64_t now) {
+        auto& q = queues.forCPU(core);
+        LockGuard g{q.lock};
+        while (q.first != nullptr && q.first->deadline <= now) {
+            HrTimer* t = q.first;
+            q.first = t->next;
+            t->next = nullptr;
+            t->pending = false;
+            t->fn(t->arg);
+        }
+    }
+}
+
+void sleep_micros(uint32_t us) {
+    using namespace gheith;
+
+    HrTimer t;
+    t.fn = [](void* arg) {
+        schedule((TCB*) arg);
+    };
+
+    uint64_t deadline = rdtsc() + (uint64_t) us * Pit::tscPerMicro;
+    block(BlockOption::MustBlock, [&t, deadline](TCB* me) {
+        ASSERT(!me->isIdle);
+        t.arg = me;
+        HrTimers::add(&t, deadline);
+    });
+}
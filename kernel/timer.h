@@ -0,0 +1,66 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include "stdint.h"
+
+// A callback that runs at a given jiffy. The callback runs on core 0 from
+// the timer interrupt (interrupts disabled, wheel lock held) so it has to
+// be quick and can't block; waking a thread is the usual thing to do.
+//
+// The owner keeps the memory, it can live on the stack of the thread that
+// waits for it as long as it is cancelled (or has fired) before returning.
+struct Timer {
+    Timer* next = nullptr;
+    Timer** pprev = nullptr;        // whatever points at us
+    uint64_t expires = 0;           // in the wheel's own jiffies
+    void (*fn)(void*) = nullptr;
+    void* arg = nullptr;
+    bool pending = false;
+};
+
+namespace TimerWheel {
+    // arm t for the given jiffy, one in the past fires on the next tick
+    void add(Timer* t, uint32_t expires);
+
+    // true if t was still pending. Once it returns the callback isn't
+    // running and won't run.
+    bool cancel(Timer* t);
+
+    // called by core 0 once per jiffy
+    void tick();
+}
+
+// block the calling thread for at least n jiffies (n - 1 whole ones)
+extern void sleep_jiffies(uint32_t n);
+
+// A high resolution timer, a callback at a TSC deadline. It runs on the
+// core that armed it from that core's local APIC timer interrupt, which is
+// programmed for the nearest deadline so there is no jiffy rounding. Same
+// rules as Timer, and the callback can't re-arm a timer on its own core.
+struct HrTimer {
+    HrTimer* next = nullptr;
+    uint64_t deadline = 0;
+    void (*fn)(void*) = nullptr;
+    void* arg = nullptr;
+    uint32_t core = 0;
+    bool pending = false;
+};
+
+namespace HrTimers {
+    // arm t on the calling core for the given rdtsc() value
+    void add(HrTimer* t, uint64_t deadline);
+
+    // true if t was still pending, the callback won't run after this
+    bool cancel(HrTimer* t);
+
+    // the nearest deadline on this core, ~0 if there isn't one
+    uint64_t next(uint32_t core);
+
+    // called from the core's timer interrupt, runs everything that is due
+    void expire(uint32_t core, uint64_t now);
+}
+
+// block the calling thread for at least us microseconds
+extern void sleep_micros(uint32_t us);
+
+#endif
@@ -16,7 +16,12 @@ namespace gheith {
 
     uint32_t* shared = nullptr;
 
-    void map(uint32_t* pd, uint32_t va, uint32_t pa) {
+    // device registers live in the last 4MB below private space
+    constexpr uint32_t DEVICE_VA = 0x7FC00000;
+    uint32_t device_next = DEVICE_VA;
+    InterruptSafeLock device_lock{};
+
+    void map(uint32_t* pd, uint32_t va, uint32_t pa, uint32_t flags) {
         auto pdi = va >> 22;
         auto pti = (va >> 12) & 0x3FF;
         auto pde = pd[pdi];
@@ -25,10 +30,10 @@ namespace gheith {
             pd[pdi] = pde;
         }
         auto pt = (uint32_t*) (pde & 0xFFFFF000);
-        pt[pti] = pa | 7;
+        pt[pti] = pa | flags;
     }
 
-    void unmap(uint32_t* pd, uint32_t va) {
+    void unmap(uint32_t* pd, uint32_t va, bool free_frame) {
         auto pdi = va >> 22;
         auto pti = (va >> 12) & 0x3FF;
         auto pde = pd[pdi];
@@ -38,7 +43,7 @@ namespace gheith {
         if ((pte & 1) == 0) return;
         auto pa = pte & 0xFFFFF000;
         pt[pti] = 0;
-        dealloc_frame(pa);
+        if (free_frame) dealloc_frame(pa);
         invlpg(va);
     }
 
@@ -49,6 +54,7 @@ namespace gheith {
         auto shared_size = 4 * (((kConfig.memSize + m4 - 1) / m4));
 
         memcpy(pd,shared,shared_size);
+        pd[DEVICE_VA >> 22] = shared[DEVICE_VA >> 22];
 
         map(pd,kConfig.ioAPIC,kConfig.ioAPIC);
         map(pd,kConfig.localAPIC,kConfig.localAPIC);
@@ -75,7 +81,31 @@ void global_init() {
         map(shared,va,va);
     }
 
+    // the device window's page table is shared, mappings added later show up everywhere
+    ASSERT(kConfig.memSize <= DEVICE_VA);
+    shared[DEVICE_VA >> 22] = PhysMem::alloc_frame() | 3;
+
+}
 
+uint32_t map_device(uint32_t pa, uint32_t size) {
+    using namespace gheith;
+    uint32_t offset = pa & (FRAME_SIZE - 1);
+    uint32_t bytes = PhysMem::frameup(offset + size);
+
+    uint32_t va;
+    {
+        LockGuard g{device_lock};
+        va = device_next;
+        device_next += bytes;
+    }
+    if (va + bytes > DEVICE_VA + (1 << 22)) {
+        Debug::panic("*** no room to map device registers at %x\n", pa);
+    }
+    // present, writable, write through, cache disabled and not for user mode
+    for (uint32_t i = 0; i < bytes; i += FRAME_SIZE) {
+        map(shared, va + i, PhysMem::framedown(pa) + i, 0x1B);
+    }
+    return va + offset;
 }
 
 void per_core_init() {
@@ -6,8 +6,10 @@
 namespace gheith {
     extern uint32_t* make_pd();
     extern void delete_pd(uint32_t*);
-    extern void map(uint32_t* pd, uint32_t va, uint32_t pa);
-    extern void unmap(uint32_t* pd, uint32_t va);
+    // flags 7 is present, writable and user, 5 leaves out writable
+    extern void map(uint32_t* pd, uint32_t va, uint32_t pa, uint32_t flags = 7);
+    // free_frame is false for frames the process doesn't own (DMA buffers)
+    extern void unmap(uint32_t* pd, uint32_t va, bool free_frame = true);
 }
 
 namespace VMM {
@@ -17,6 +19,11 @@ namespace VMM {
 
     // Called on each core to do per-core initialization
     extern void per_core_init();
+
+    // Maps "size" bytes of device registers at physical "pa" with caching off.
+    // They go in the kernel's shared page tables so every address space sees
+    // them. Returns the virtual address.
+    extern uint32_t map_device(uint32_t pa, uint32_t size);
 }
 
 #endif
@@ -0,0 +1,110 @@
+#include "wav.h"
+#include "libk.h"
+#include "machine.h"
+#include "debug.h"
+
+using namespace audio;
+
+static bool is_id(const char* id, const char* want) {
+    for (int i = 0; i < 4; i++) {
+        if (id[i] != want[i]) return false;
+    }
+    return true;
+}
+
+WavSource* WavSource::open(Shared<Node> file) {
+    if (file == nullptr || !file->is_file()) return nullptr;
+
+    uint32_t size = file->size_in_bytes();
+    if (size < sizeof(RiffHeader)) return nullptr;
+
+    RiffHeader riff;
+    file->read(0, riff);
+    if (!is_id(riff.riff, "RIFF") || !is_id(riff.wave, "WAVE")) return nullptr;
+
+    auto wav = new WavSource(file);
+    bool have_fmt = false;
+
+    // walk the chunks until we find the samples, "fmt " has to come first
+    uint32_t offset = sizeof(RiffHeader);
+    while (offset + sizeof(ChunkHeader) <= size) {
+        ChunkHeader chunk;
+        file->read(offset, chunk);
+        offset += sizeof(ChunkHeader);
+
+        if (is_id(chunk.id, "fmt ") && chunk.size >= sizeof(WavFormat)) {
+            file->read(offset, wav->fmt);
+            have_fmt = true;
+            if (wav->fmt.format == 0xFFFE) {
+                // extensible is only PCM if its sub format says so
+                WavFormatExtension ext;
+                have_fmt = chunk.size >= sizeof(WavFormat) + sizeof(ext);
+                if (have_fmt) {
+                    file->read(offset + sizeof(WavFormat), ext);
+                    have_fmt = (ext.sub_format == 1);
+                }
+            }
+        } else if (is_id(chunk.id, "data") && have_fmt) {
+            wav->data_offset = offset;
+            wav->data_size = K::min(chunk.size, size - offset);
+            break;
+        }
+
+        // a chunk that runs past the end of the file is garbage (the data
+        // chunk may be cut short, streamed files don't know their size)
+        if (chunk.size > size - offset) break;
+
+        // chunks are padded to an even size
+        offset += chunk.size + (chunk.size & 1);
+    }
+
+    WavFormat& fmt = wav->fmt;
+    if (wav->data_offset == 0 || (fmt.format != 1 && fmt.format != 0xFFFE) ||
+        fmt.channels == 0 || fmt.block_align == 0) {
+        delete wav;
+        return nullptr;
+    }
+
+    // never split a frame
+    wav->data_size -= wav->data_size % fmt.block_align;
+
+    return wav;
+}
+
+uint32_t WavSource::fill(char* buffer, uint32_t bytes) {
+    uint32_t n = K::min(bytes, data_size - position);
+    if (n == 0) return 0;
+
+    uint32_t block_size = file->block_size;
+    uint32_t start = data_offset + position;
+    uint32_t end = start + n;
+    uint32_t offset = start;
+
+    while (offset < end) {
+        uint32_t block = offset / block_size;
+        uint32_t offset_in_block = offset % block_size;
+        uint32_t count = K::min(block_size - offset_in_block, end - offset);
+        char* dest = buffer + (offset - start);
+
+        if (count == block_size) {
+            // the whole block lands in the buffer, read it in place
+            file->read_block(block, dest);
+            direct_bytes += count;
+        } else {
+            file->read_block(block, bounce);
+            memcpy(dest, &bounce[offset_in_block], count);
+            bounced_bytes += count;
+        }
+        offset += count;
+    }
+
+    // wav keeps 8 bit samples unsigned, the codec wants them signed like the rest
+    if (fmt.bits_per_sample == 8) {
+        for (uint32_t i = 0; i < n; i++) {
+            buffer[i] ^= 0x80;
+        }
+    }
+
+    position += n;
+    return n;
+}
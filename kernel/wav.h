@@ -0,0 +1,72 @@
+#ifndef _wav_h_
+#define _wav_h_
+
+#include "stdint.h"
+#include "ext2.h"
+#include "audio.h"
+
+// RIFF/WAVE parsing and playback
+//
+// reference: http://soundfile.sapp.org/doc/WaveFormat/
+
+namespace audio {
+
+    struct RiffHeader {
+        char riff[4];       // "RIFF"
+        uint32_t size;
+        char wave[4];       // "WAVE"
+    };
+
+    struct ChunkHeader {
+        char id[4];
+        uint32_t size;      // not counting this header or the pad byte
+    };
+
+    struct WavFormat {
+        uint16_t format;    // 1 -> PCM, 0xFFFE -> extensible
+        uint16_t channels;
+        uint32_t sample_rate;
+        uint32_t byte_rate;
+        uint16_t block_align;
+        uint16_t bits_per_sample;
+    };
+
+    // what follows WavFormat in a WAVE_FORMAT_EXTENSIBLE "fmt " chunk
+    struct WavFormatExtension {
+        uint16_t extension_size;
+        uint16_t valid_bits;
+        uint32_t channel_mask;
+        uint16_t sub_format;        // the first two bytes of the GUID, 1 -> PCM
+        uint8_t guid[14];
+    };
+
+    // Plays the data chunk of a PCM wav file. fill() reads whole file system
+    // blocks straight into the buffer it is given (the DMA buffers) so samples
+    // are only ever touched by the disk and the controller. Only the blocks that
+    // straddle the start or end of a buffer go through a bounce block.
+    class WavSource : public audio_source {
+        Shared<Node> file;
+        char* bounce;               // one block, allocated once
+        uint32_t position;          // bytes of the data chunk played so far
+    public:
+        WavFormat fmt;
+        uint32_t data_offset;       // where the samples start in the file
+        uint32_t data_size;
+        uint32_t direct_bytes;      // bytes read in place
+        uint32_t bounced_bytes;     // bytes copied out of the bounce block
+
+        // Parses the headers, returns nullptr if this isn't a PCM wav file
+        static WavSource* open(Shared<Node> file);
+
+        WavSource(Shared<Node> file) : file(file), bounce(new char[file->block_size]), position(0),
+            fmt(), data_offset(0), data_size(0), direct_bytes(0), bounced_bytes(0) {}
+
+        ~WavSource() {
+            delete[] bounce;
+        }
+
+        uint32_t fill(char* buffer, uint32_t bytes) override;
+    };
+}
+
+#endif
@@ -83,4 +83,82 @@ extern int execl(const char* path, const char* arg0, ...);
 /* plays file from start to finish */
 extern int play(int fd);
 
+/* audio_open */
+/* opens a 16 bit playback stream that is mixed with everything else playing */
+/* rates the codec can't run at are converted in the kernel */
+/* returns a descriptor in 30..39 or -1 if the channel count doesn't match */
+/* the streams already playing or too many are open */
+/* close() lets it play out what was written */
+extern int audio_open(unsigned rate, unsigned channels);
+
+/* audio_write */
+/* blocks until all nbyte bytes are queued */
+extern ssize_t audio_write(int id, const void* buf, size_t nbyte);
+
+/* record */
+/* blocks until nbyte bytes of 16 bit samples from the input pin are in buf */
+/* the first call starts the capture stream, nbyte == 0 stops it */
+/* and drops whatever wasn't read. returns -1 if there is nothing to record from */
+extern ssize_t record(void* buf, size_t nbyte);
+
+/* audio_clock */
+/* the playback clock, read from the controller's DMA position buffer */
+/* position and queued are frames of what the codec plays, queued is how far */
+/* behind the hardware a sample written now will be heard. pending is what */
+/* stream 'id' has written that hasn't been mixed yet (0 if id isn't a stream) */
+struct audio_clock {
+    uint32_t position;
+    uint32_t queued;
+    uint32_t jiffies;
+    uint32_t rate;
+    uint32_t pending;
+};
+extern int audio_clock(int id, struct audio_clock* clock);
+
+/* audio_stats */
+/* glitch counters since boot. underruns is how often the hardware caught up */
+/* with the kernel, silenced how many periods it played as silence because of */
+/* that, overruns how many recorded periods were dropped. stream is how many */
+/* periods stream 'id' was short when the mixer read it (0 if id isn't a stream) */
+struct audio_stats {
+    uint32_t periods;
+    uint32_t underruns;
+    uint32_t silenced;
+    uint32_t overruns;
+    uint32_t stream;
+};
+extern int audio_stats(int id, struct audio_stats* stats);
+
+/* audio_mmap */
+/* maps the output's DMA buffers (info->buffer_bytes, written at 0xF0000000) */
+/* followed by a read only page. The controller keeps the play position */
+/* (a byte offset into the buffers) in the uint32_t at index */
+/* info->position_index of that page, info sits 0x800 bytes into it. */
+/* Samples are 16 bit at info->rate with info->channels; write them ahead of */
+/* the position. Nothing else plays while the buffers are mapped. */
+/* returns the address of the buffers or 0 (not negative) if streams are */
+/* playing or another process has them. rate == 0 gives them back, so does exit */
+/* fork doesn't copy the mapping */
+struct audio_mmap_info {
+    uint32_t position_index;
+    uint32_t buffer_bytes;
+    uint32_t period_bytes;
+    uint32_t rate;
+    uint32_t channels;
+    uint32_t periods;
+};
+extern void* audio_mmap(unsigned rate, unsigned channels);
+
+/* set_priority */
+/* 0 is a normal process, 1 to 7 are real-time levels (8 is kept for the */
+/* kernel's own threads). A ready real-time process always runs before */
+/* normal ones and only gives way to real-time processes at its level or */
+/* above. Children inherit it. */
+/* returns the previous priority or -1 if rt is out of range */
+extern int set_priority(unsigned rt);
+
+/* sleep */
+/* blocks for at least ms milliseconds, 0 just gives up the cpu */
+extern int sleep(unsigned ms);
+
 #endif